@@ -0,0 +1,80 @@
+#include "adaptive.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sensor_types.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) &&                                       \
+    defined(CONFIG_ESP_ADAPTIVE_RESOLUTION)
+
+static const char *TAG = "adaptive";
+
+SENSOR_STATE_ATTR static adaptive_sensor_t s_sensors[CONFIG_ESP_MAX_SENSORS];
+
+static int clamp_resolution(int resolution, int max_resolution) {
+  if (resolution > max_resolution) {
+    return max_resolution;
+  }
+  if (resolution < CONFIG_ESP_ADAPTIVE_MIN_RESOLUTION) {
+    return CONFIG_ESP_ADAPTIVE_MIN_RESOLUTION;
+  }
+  return resolution;
+}
+
+void adaptive_reset(void) { memset(s_sensors, 0, sizeof(s_sensors)); }
+
+int adaptive_select(int sensor, int max_resolution) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS ||
+      !s_sensors[sensor].primed) {
+    return max_resolution;
+  }
+
+  return clamp_resolution(s_sensors[sensor].resolution, max_resolution);
+}
+
+void adaptive_update(int sensor, float temperature, int max_resolution) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  adaptive_sensor_t *s = &s_sensors[sensor];
+  int16_t current = (int16_t)lroundf(temperature * 100);
+
+  if (!s->primed) {
+    *s = (adaptive_sensor_t){
+        .last_temperature = current,
+        .resolution = max_resolution,
+        .primed = true,
+    };
+    return;
+  }
+
+  int delta = abs(current - s->last_temperature);
+  bool in_band = current >= CONFIG_ESP_ADAPTIVE_ALARM_LOW &&
+                 current <= CONFIG_ESP_ADAPTIVE_ALARM_HIGH;
+  int previous = s->resolution;
+
+  s->last_temperature = current;
+
+  if (in_band || delta >= CONFIG_ESP_ADAPTIVE_RISE_DELTA) {
+    s->resolution = max_resolution;
+    s->stable_cycles = 0;
+  } else if (delta <= CONFIG_ESP_ADAPTIVE_FALL_DELTA) {
+    if (++s->stable_cycles >= CONFIG_ESP_ADAPTIVE_STABLE_CYCLES) {
+      s->resolution = clamp_resolution(s->resolution - 1, max_resolution);
+      s->stable_cycles = 0;
+    }
+  } else {
+    s->stable_cycles = 0;
+  }
+
+  if (s->resolution != previous) {
+    ESP_LOGI(TAG, "Sensor %d: %d -> %d bits (moved %d.%02d C)", sensor,
+             previous, s->resolution, delta / 100, delta % 100);
+  }
+}
+
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_ADAPTIVE_RESOLUTION
@@ -0,0 +1,61 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) &&                                       \
+    defined(CONFIG_ESP_ADAPTIVE_RESOLUTION)
+
+/**
+ * @brief The adaptive resolution state of a sensor.
+ *
+ * Kept across deep sleep so the history survives it.
+ */
+typedef struct {
+  int16_t last_temperature; ///< Previous reading, in hundredths of a degree
+  uint8_t resolution;       ///< Resolution for the next conversion, in bits
+  uint8_t stable_cycles;    ///< Consecutive stable readings at this resolution
+  bool primed;              ///< Whether `last_temperature` holds a reading
+} adaptive_sensor_t;
+
+/**
+ * @brief Returns the resolution a sensor should convert at this cycle.
+ *
+ * Until the sensor has a reading, the configured resolution is used.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param max_resolution The configured resolution of the sensor, in bits.
+ * @return int The resolution, between `CONFIG_ESP_ADAPTIVE_MIN_RESOLUTION`
+ * and `max_resolution`.
+ */
+int adaptive_select(int sensor, int max_resolution);
+
+/**
+ * @brief Updates the state of a sensor with a new reading.
+ *
+ * A reading that moved by `CONFIG_ESP_ADAPTIVE_RISE_DELTA` or more, or that
+ * lies in the alarm band, restores the configured resolution at once. The
+ * resolution is lowered by one bit after `CONFIG_ESP_ADAPTIVE_STABLE_CYCLES`
+ * consecutive readings that moved by `CONFIG_ESP_ADAPTIVE_FALL_DELTA` or
+ * less. Readings in between keep the resolution and restart the count.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param temperature The new reading, in degrees Celsius.
+ * @param max_resolution The configured resolution of the sensor, in bits.
+ * @return void
+ */
+void adaptive_update(int sensor, float temperature, int max_resolution);
+
+/**
+ * @brief Forgets the history of every sensor.
+ *
+ * Called when the sensors are renumbered, e.g. after a discovery.
+ *
+ * @return void
+ */
+void adaptive_reset(void);
+
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_ADAPTIVE_RESOLUTION
+
+#endif // ADAPTIVE_H
@@ -4,13 +4,107 @@
 #include "esp_adc_cal.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
 #include "time.h"
 
+#include <string.h>
+
 static const char *TAG = "snow_app";
 
+/**
+ * Returns the number of seconds until the next wake.
+ */
+static int next_wake_seconds(app_state_t *state) {
+#if defined(CONFIG_ESP_SCANNER_MODE) || defined(CONFIG_ESP_SIMULATED_DEVICE)
+  return CONFIG_ESP_SLEEP_DURATION;
+#else
+  return scheduler_seconds_until_next(state->devices.ready, state->num_sensors,
+                                      time(NULL));
+#endif
+}
+
+static int count_valid_readings(app_state_t *state) {
+  int count = 0;
+#ifndef CONFIG_ESP_SCANNER_MODE
+  for (int i = 0; i < state->num_sensors; i++) {
+    if (state->sensor_readings[i].valid) {
+      count++;
+    }
+  }
+#endif
+  return count;
+}
+
+/**
+ * Enters a supervised phase, at the CPU frequency the phase needs.
+ */
+static void begin_phase(supervisor_phase_t phase) {
+  supervisor_begin_phase(phase);
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+  power_begin_phase(phase);
+#endif
+}
+
+/**
+ * Leaves the current phase, the CPU may slow down again.
+ */
+static void end_phase(void) {
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+  power_end_phase();
+#endif
+  supervisor_end_phase();
+}
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+// RTC slow memory is 8 KB on the ESP32. Most of it goes to the state that
+// grows with the configuration, the rest to the fixed statistics.
+#define APP_RTC_DATA_LIMIT (7 * 1024)
+
+#ifdef CONFIG_ESP_ADAPTIVE_RESOLUTION
+#define APP_RTC_ADAPTIVE_SIZE sizeof(adaptive_sensor_t)
+#else
+#define APP_RTC_ADAPTIVE_SIZE 0
+#endif
+
+// Schedule, health, statistics, command overrides and adaptive resolution,
+// in RTC memory only when the node deep sleeps
+#ifdef CONFIG_ESP_SLEEP_MODE
+#define APP_RTC_SENSOR_SIZE                                                    \
+  (sizeof(uint32_t) + sizeof(health_sensor_t) + sizeof(sensor_stats_t) +       \
+   sizeof(command_override_t) + APP_RTC_ADAPTIVE_SIZE)
+#else
+#define APP_RTC_SENSOR_SIZE 0
+#endif
+
+_Static_assert(CONFIG_ESP_MAX_SENSORS * APP_RTC_SENSOR_SIZE +
+                       CONFIG_ESP_BACKLOG_SIZE * sizeof(backlog_entry_t) +
+                       CONFIG_ESP_MQTT_DNS_CACHE_SIZE *
+                           sizeof(dns_cache_entry_t) <=
+                   APP_RTC_DATA_LIMIT,
+               "The RTC state does not fit, lower ESP_MAX_SENSORS, "
+               "ESP_BACKLOG_SIZE or ESP_MQTT_DNS_CACHE_SIZE");
+
+#define APP_READINGS_LOCK_WAIT_MS 100 ///< Longest wait of the overrun handler
+
+// Guards the state of the readings and the backlog against
+// app_handle_overrun(), which runs in the timer task
+static StaticSemaphore_t s_readings_lock_buffer;
+static SemaphoreHandle_t s_readings_lock = NULL;
+
+static void lock_readings(void) {
+  xSemaphoreTake(s_readings_lock, portMAX_DELAY);
+}
+
+static void unlock_readings(void) { xSemaphoreGive(s_readings_lock); }
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
 void app_init(app_state_t *state) {
   ESP_LOGI(TAG, "Initializing application");
 
@@ -18,11 +112,16 @@ void app_init(app_state_t *state) {
   clock_gettime(CLOCK_REALTIME, &state->start_time);
 #endif
 
+#ifndef CONFIG_ESP_SCANNER_MODE
+  if (s_readings_lock == NULL) {
+    s_readings_lock = xSemaphoreCreateMutexStatic(&s_readings_lock_buffer);
+  }
+#endif
+
   // Initialize the application state
   state->running = true;
-  state->errors = NULL;
   state->num_errors = 0;
-  state->bus_handles = NULL;
+  state->num_dropped_errors = 0;
   state->num_buses = 0;
 
   // Initialize NVS
@@ -34,11 +133,10 @@ void app_init(app_state_t *state) {
   }
   ESP_ERROR_CHECK(ret);
 
-#ifdef CONFIG_ESP_SLEEP_MODE
-  ESP_LOGI(TAG, "Configuring deep sleep mode for %d seconds",
-           CONFIG_ESP_SLEEP_DURATION);
-  esp_sleep_enable_timer_wakeup(CONFIG_ESP_SLEEP_DURATION *
-                                1000000); // seconds to microseconds
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+  if (power_init() != ESP_OK) {
+    ESP_LOGW(TAG, "Power management unavailable, running at full power");
+  }
 #endif
 
 #ifdef CONFIG_ESP_DEBUG_MODE
@@ -48,56 +146,51 @@ void app_init(app_state_t *state) {
 #endif
 
 #ifndef CONFIG_ESP_SCANNER_MODE
-  ESP_LOGI(TAG, "Parsing one-wire configuration");
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+  ESP_LOGI(TAG, "Loading discovered sensors");
 
-  onewire_config_t *onewire_config =
-      parse_onewire_config(CONFIG_ESP_ONE_WIRE_CONFIG_STRING);
+  if (discovery_load_config(&state->onewire_config) < 0) {
+    app_append_error(state, 1, "Failed to load discovered sensors");
+    state->running = false;
+    return;
+  }
+#else
+  ESP_LOGI(TAG, "Parsing one-wire configuration");
 
-  if (onewire_config == NULL) {
+  if (parse_onewire_config(CONFIG_ESP_ONE_WIRE_CONFIG_STRING,
+                           &state->onewire_config) < 0) {
     app_append_error(state, 1, "Failed to parse one-wire configuration");
     state->running = false;
     return;
   }
-
-  state->onewire_config = *onewire_config;
+#endif
 
   ESP_LOGD(TAG, "Configuration:");
   ESP_LOGD(TAG, "OneWire buses (%d):", state->onewire_config.bus_count);
   for (int i = 0; i < state->onewire_config.bus_count; i++) {
-    ESP_LOGD(TAG, "  Bus %d (GPIO: %d)", i,
-             state->onewire_config.buses[i]->pin);
-    for (int j = 0; j < state->onewire_config.buses[i]->sensor_count; j++) {
-      sensor_config_t *sensor = state->onewire_config.buses[i]->sensors[j];
-      ESP_LOGD(TAG, "    Sensor %d (address: %s, idx: %d, resolution: %d)", j,
-               sensor->address, sensor->idx, sensor->resolution);
+    ESP_LOGD(TAG, "  Bus %d (GPIO: %d)", i, state->onewire_config.buses[i].pin);
+    for (int j = 0; j < state->onewire_config.buses[i].sensor_count; j++) {
+      sensor_config_t *sensor = &state->onewire_config.buses[i].sensors[j];
+      ESP_LOGD(TAG, "    Sensor %d (address: %016llX, idx: %d, resolution: %d)",
+               j, sensor->address, sensor->idx, sensor->resolution);
     }
   }
 
   ESP_LOGI(TAG, "Parsing MQTT configuration");
-  mqtt_config_t mqtt_config;
-  mqtt_config.broker_count = 0;
-  mqtt_config.broker_capacity = 1;
-  mqtt_config.brokers =
-      malloc(sizeof(mqtt_broker_config_t) * mqtt_config.broker_capacity);
-  parse_mqtt_connection_string(CONFIG_ESP_MQTT_CONNECTION_STRING, &mqtt_config);
-
-  state->mqtt_config = mqtt_config;
-
-  ESP_LOGD(TAG, "Brokers (%d):", mqtt_config.broker_count);
-  for (int i = 0; i < mqtt_config.broker_count; i++) {
-    mqtt_broker_config_t *broker = &mqtt_config.brokers[i];
+  parse_mqtt_connection_string(CONFIG_ESP_MQTT_CONNECTION_STRING,
+                               &state->mqtt_config);
+
+  ESP_LOGD(TAG, "Brokers (%d):", state->mqtt_config.broker_count);
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    mqtt_broker_config_t *broker = &state->mqtt_config.brokers[i];
     ESP_LOGD(TAG, " - Broker %d:", i);
-    ESP_LOGD(TAG, "    - Protocol: %s",
-             broker->protocol ? broker->protocol : "NULL");
-    ESP_LOGD(TAG, "    - Host: %s", broker->host ? broker->host : "NULL");
+    ESP_LOGD(TAG, "    - Protocol: %s", broker->protocol);
+    ESP_LOGD(TAG, "    - Host: %s", broker->host);
     ESP_LOGD(TAG, "    - Port: %d", broker->port);
-    ESP_LOGD(TAG, "    - Username: %s",
-             broker->username ? broker->username : "NULL");
-    ESP_LOGD(TAG, "    - Password: %s",
-             broker->password ? broker->password : "NULL");
-    ESP_LOGD(TAG, "    - Client ID: %s",
-             broker->client_id ? broker->client_id : "NULL");
-    ESP_LOGD(TAG, "    - Topic: %s", broker->topic ? broker->topic : "NULL");
+    ESP_LOGD(TAG, "    - Username: %s", broker->username);
+    ESP_LOGD(TAG, "    - Password: %s", broker->password);
+    ESP_LOGD(TAG, "    - Client ID: %s", broker->client_id);
+    ESP_LOGD(TAG, "    - Topic: %s", broker->topic);
   }
 
 #endif
@@ -137,6 +230,52 @@ void app_run(app_state_t *state) {
 #endif // CONFIG_ESP_SCANNER_MODE
 }
 
+// The scanner attaches its buses batch by batch, like a multiplexed bus
+#if defined(CONFIG_ESP_BUS_MULTIPLEX) || defined(CONFIG_ESP_SCANNER_MODE)
+#define APP_ATTACH_BUSES
+#endif
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) || !defined(CONFIG_ESP_SIMULATED_DEVICE)
+
+/**
+ * Gives a bus its RMT channels for an acquisition slot. Without multiplexing
+ * every bus stays attached from `init_onewire_buses()` on, so this only
+ * checks the handle. ESP_ERR_NOT_FOUND tells that the RMT channels are all
+ * taken.
+ */
+static esp_err_t attach_bus(app_state_t *state, int bus) {
+#ifdef APP_ATTACH_BUSES
+  esp_err_t err = init_sensor_bus(state->onewire_config.buses[bus].pin,
+                                  &state->bus_handles[bus]);
+  if (err == ESP_ERR_NOT_FOUND) {
+    ESP_LOGD(TAG, "No free RMT channels for bus %d", bus);
+  } else if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to attach bus %d: %s", bus, esp_err_to_name(err));
+  }
+  if (err != ESP_OK) {
+    state->bus_handles[bus] = NULL;
+    return err;
+  }
+#endif
+
+  return state->bus_handles[bus] != NULL ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/**
+ * Releases the RMT channels of a bus at the end of its slot, so the next bus
+ * can use them.
+ */
+static void detach_bus(app_state_t *state, int bus) {
+#ifdef APP_ATTACH_BUSES
+  if (state->bus_handles[bus] != NULL) {
+    onewire_bus_del(state->bus_handles[bus]);
+    state->bus_handles[bus] = NULL;
+  }
+#endif
+}
+
+#endif // !CONFIG_ESP_SCANNER_MODE || !CONFIG_ESP_SIMULATED_DEVICE
+
 #ifdef CONFIG_ESP_SCANNER_MODE
 void run_scanner_mode(app_state_t *state) {
 #ifdef CONFIG_ESP_SIMULATED_DEVICE
@@ -151,12 +290,15 @@ void run_scanner_mode(app_state_t *state) {
 #else
   ESP_LOGI(TAG, "Running in scanner mode");
 #ifdef CONFIG_ESP_SCANNER_GPIO
-  char delimiter = ','; // Delimiter used to separate the numbers
-  int numbers[32];      // Array to store the converted numbers
-  int num_count;        // Variable to store the number of integers converted
+  // Sized by the capacity options, too large for the stack
+  static scanner_bus_t buses[CONFIG_ESP_MAX_BUSES];
+  char delimiter = ',';           // Delimiter used to separate the numbers
+  int pins[CONFIG_ESP_MAX_BUSES]; // Array to store the converted numbers
+  int num_count; // Variable to store the number of integers converted
 
   // Convert the string to an array of integers
-  num_count = str_to_int_array(CONFIG_ESP_SCANNER_GPIO, delimiter, numbers, 32);
+  num_count = str_to_int_array(CONFIG_ESP_SCANNER_GPIO, delimiter, pins,
+                               CONFIG_ESP_MAX_BUSES);
 
   if (num_count == -1 || num_count == 0) {
     app_append_error(state, 2,
@@ -165,18 +307,40 @@ void run_scanner_mode(app_state_t *state) {
     return;
   }
 
-  state->bus_handles = malloc(num_count * sizeof(onewire_bus_handle_t));
   state->num_buses = num_count;
   for (int i = 0; i < num_count; i++) {
-    esp_err_t err = init_sensor_bus(numbers[i], &state->bus_handles[i]);
-    if (err != ESP_OK) {
-      app_append_error(state, 3, "Failed to initialize 1-Wire bus");
-      state->running = false;
-      return;
+    state->onewire_config.buses[i].pin = pins[i];
+    buses[i].pin = pins[i];
+    buses[i].handle = NULL;
+  }
+
+  // Each attached bus holds a TX/RX channel pair: a batch takes buses until
+  // the RMT channels run out, and releases them for the next batch. A bus
+  // that fails to attach otherwise is reported, the others are still scanned.
+  int64_t start = esp_timer_get_time();
+  for (int first = 0, end; first < num_count; first = end) {
+    for (end = first; end < num_count; end++) {
+      esp_err_t err = attach_bus(state, end);
+      if (err == ESP_ERR_NOT_FOUND && end > first) {
+        break;
+      }
+      if (err != ESP_OK) {
+        app_append_error(state, 3, "Failed to initialize 1-Wire bus");
+      }
+      buses[end].handle = state->bus_handles[end];
     }
 
-    sensor_scan(state->bus_handles[i]);
+    ESP_LOGD(TAG, "Scanning buses %d to %d", first, end - 1);
+    scanner_run(&buses[first], end - first);
+    for (int i = first; i < end; i++) {
+      detach_bus(state, i);
+      buses[i].handle = NULL;
+    }
   }
+  ESP_LOGI(TAG, "Scanned %d buses in %lld ms", num_count,
+           (long long)((esp_timer_get_time() - start) / 1000));
+
+  scanner_print_results(buses, num_count);
 #else  // CONFIG_ESP_SCANNER_GPIO
   app_append_error(state, 4, "Scanner mode requires GPIO pins to be specified");
 #endif // CONFIG_ESP_SCANNER_GPIO
@@ -188,24 +352,119 @@ void run_scanner_mode(app_state_t *state) {
 #endif // CONFIG_ESP_SCANNER_MODE
 
 #ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * Returns the 1-Wire device of a sensor, on the current handle of its bus.
+ */
+static onewire_device_t sensor_device(app_state_t *state, int sensor_id) {
+  return (onewire_device_t){
+      .bus = state->bus_handles[state->devices.bus[sensor_id]],
+      .address = state->devices.rom[sensor_id],
+  };
+}
+
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+
+/**
+ * Searches the buses that need it. When the sensors change, their flat ids
+ * do too, so the per-sensor history kept in RTC memory is dropped.
+ */
+static void discover_sensors(app_state_t *state) {
+  if (!discovery_pending()) {
+    return;
+  }
+
+  bool changed = false;
+  for (int i = 0; i < state->num_buses; i++) {
+    if (!discovery_requested(i) || attach_bus(state, i) != ESP_OK) {
+      continue;
+    }
+    if (discovery_search(state->bus_handles[i], i)) {
+      changed = true;
+    }
+    detach_bus(state, i);
+  }
+
+  if (discovery_commit(&state->onewire_config, changed) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to store the discovered sensors");
+  }
+
+  if (changed) {
+    // The kept readings name their sensor by its former flat index
+    lock_readings();
+    if (backlog_count() > 0) {
+      ESP_LOGW(TAG, "Sensors changed, dropping %d kept readings",
+               backlog_count());
+      pacing_count_dropped(backlog_count());
+      backlog_clear();
+    }
+    unlock_readings();
+    scheduler_reset();
+    health_reset();
+    sensor_stats_reset();
+#ifdef CONFIG_ESP_ADAPTIVE_RESOLUTION
+    adaptive_reset();
+#endif
+  }
+}
+
+/**
+ * Requests a search of the buses where a sensor went missing, of the empty
+ * buses where a device now answers the reset pulse, and from time to time of
+ * the other buses, where a sensor may have been added.
+ */
+static void check_presence(app_state_t *state) {
+  for (int i = 0; i < state->num_sensors; i++) {
+    if (health_get_state(i) == HEALTH_MISSING) {
+      discovery_request(state->devices.bus[i]);
+    }
+  }
+
+  bool periodic = discovery_count_cycle();
+  for (int i = 0; i < state->num_buses; i++) {
+    if (state->onewire_config.buses[i].sensor_count > 0) {
+      if (periodic) {
+        discovery_request(i);
+      }
+      continue;
+    }
+    if (attach_bus(state, i) != ESP_OK) {
+      continue;
+    }
+
+    if (onewire_bus_reset(state->bus_handles[i]) == ESP_OK) {
+      ESP_LOGI(TAG, "Device present on empty bus %d", i);
+      discovery_request(i);
+    }
+    detach_bus(state, i);
+  }
+}
+
+#endif // CONFIG_ESP_AUTO_DISCOVERY
+
 void run_normal_mode(app_state_t *state) {
+  app_reset_cycle(state);
 
 #ifdef CONFIG_ESP_SIMULATED_DEVICE
   ESP_LOGI(TAG, "Running in simulation mode");
 
   // Simulate the sensor readings
-  state->num_sensors = 4;
-  state->sensor_readings =
-      malloc(state->num_sensors * sizeof(sensor_reading_t));
+  state->num_sensors = CONFIG_ESP_MAX_SENSORS < 4 ? CONFIG_ESP_MAX_SENSORS : 4;
 
   for (int i = 0; i < state->num_sensors; i++) {
     state->sensor_readings[i].idx = i;
+    state->devices.idx[i] = i;
     state->sensor_readings[i].temperature = 20.0 + i;
+    state->sensor_readings[i].valid = true;
+    state->sensor_readings[i].resolution = 12;
+    state->sensor_readings[i].spread = 0;
 
     ESP_LOGI(TAG, "Sensor %d temperature: %.2f C", i,
              state->sensor_readings[i].temperature);
   }
 
+  topics_build(&state->mqtt_config, &state->devices, state->num_sensors);
+
   // Connect to Wi-Fi
   ESP_LOGI(TAG, "Connecting to Wi-Fi");
   esp_err_t err = wifi_init_sta();
@@ -222,36 +481,84 @@ void run_normal_mode(app_state_t *state) {
 
 #else
 
-  if (state->bus_handles == NULL) {
+  if (state->num_buses == 0) {
     init_onewire_buses(state);
-  }
-
-  if (state->num_sensors == 0) {
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+    discover_sensors(state);
+#endif
     calculate_num_sensors(state);
+    init_sensor_pool(state);
+
+    if (!state->running) {
+      return;
+    }
   }
 
+#ifdef CONFIG_ESP_PIPELINE
+  if (wifi_should_skip_network()) {
+    pipeline_reset();
+    begin_phase(SUPERVISOR_PHASE_ACQUISITION);
+    read_sensors(state);
+    end_phase();
+    store_sensor_readings(state);
+  } else {
+    run_pipeline(state);
+  }
+  if (state->num_errors > 0) {
+    log_errors(state);
+  }
+#else
+  begin_phase(SUPERVISOR_PHASE_ACQUISITION);
   read_sensors(state);
+  end_phase();
 
   if (state->num_errors > 0) {
+    // The readings that were taken still go out
     log_errors(state);
+  }
+  if (count_valid_readings(state) == 0 &&
+             !health_has_events(state->num_sensors)) {
+    ESP_LOGI(TAG, "No reading to publish, skipping the network");
+  } else if (wifi_should_skip_network()) {
+    store_sensor_readings(state);
   } else {
 
     // Connect to Wi-Fi
     ESP_LOGI(TAG, "Connecting to Wi-Fi");
+    begin_phase(SUPERVISOR_PHASE_CONNECT);
     esp_err_t err = wifi_init_sta();
+    end_phase();
     if (err != ESP_OK) {
-      app_append_error(state, 7, "Failed to connect to Wi-Fi. Exiting.");
-      state->running = false;
-      return;
+      app_append_error(state, 7, "Failed to connect to Wi-Fi");
+      store_sensor_readings(state);
+    } else {
+      publish_sensor_readings(state);
     }
-
-    publish_sensor_readings(state);
   }
+#endif
+
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+  check_presence(state);
+#endif
 
 #ifdef CONFIG_ESP_SLEEP_MODE
   state->running = false;
 #else
-  vTaskDelay(CONFIG_ESP_SLEEP_DURATION * 1000 / portTICK_PERIOD_MS);
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+  if (discovery_pending()) {
+    // Rebuild the buses and the pool around the search next cycle
+    app_free_state(state);
+  }
+#endif
+
+  // The idle wait is not part of the supervised cycle
+  supervisor_disarm();
+  int wait = next_wake_seconds(state);
+  ESP_LOGI(TAG, "Next reading due in %d seconds", wait);
+  // With light sleep, the chip sleeps through the delay and wakes on its
+  // timeout, or on network traffic
+  vTaskDelay(wait * 1000 / portTICK_PERIOD_MS);
+  supervisor_arm();
 #endif
 
 #endif
@@ -260,12 +567,14 @@ void run_normal_mode(app_state_t *state) {
 void init_onewire_buses(app_state_t *state) {
   ESP_LOGI(TAG, "Initializing 1-Wire buses");
 
-  state->bus_handles =
-      malloc(state->onewire_config.bus_count * sizeof(onewire_bus_handle_t));
   state->num_buses = state->onewire_config.bus_count;
 
+#ifdef CONFIG_ESP_BUS_MULTIPLEX
+  // Attached one at a time by `attach_bus()`, for the duration of a slot
+  ESP_LOGI(TAG, "%d 1-Wire buses share the RMT channels", state->num_buses);
+#else
   for (int i = 0; i < state->onewire_config.bus_count; i++) {
-    esp_err_t err = init_sensor_bus(state->onewire_config.buses[i]->pin,
+    esp_err_t err = init_sensor_bus(state->onewire_config.buses[i].pin,
                                     &state->bus_handles[i]);
     if (err != ESP_OK) {
       app_append_error(state, 2, "Failed to initialize 1-Wire bus");
@@ -275,6 +584,7 @@ void init_onewire_buses(app_state_t *state) {
   }
 
   ESP_LOGI(TAG, "1-Wire buses initialized");
+#endif
 }
 
 void calculate_num_sensors(app_state_t *state) {
@@ -282,139 +592,1136 @@ void calculate_num_sensors(app_state_t *state) {
 
   state->num_sensors = 0;
   for (int i = 0; i < state->onewire_config.bus_count; i++) {
-    state->num_sensors += state->onewire_config.buses[i]->sensor_count;
+    state->num_sensors += state->onewire_config.buses[i].sensor_count;
   }
 
   ESP_LOGI(TAG, "Number of sensors: %d", state->num_sensors);
 }
 
-void read_sensors(app_state_t *state) {
-  ESP_LOGI(TAG, "Reading the sensors");
+/**
+ * Flattens the 1-Wire configuration into the device table, in bus order.
+ */
+static void build_device_table(app_state_t *state) {
+  device_table_t *devices = &state->devices;
 
-  state->sensor_readings =
-      malloc(state->num_sensors * sizeof(sensor_reading_t));
-  state->device_handles = malloc(state->num_sensors * sizeof(onewire_device_t));
-  state->sensor_handles =
-      malloc(state->num_sensors * sizeof(ds18b20_device_handle_t));
+  int sensor_id = 0;
+  for (int i = 0; i < state->onewire_config.bus_count; i++) {
+    const bus_config_t *bus = &state->onewire_config.buses[i];
+
+    for (int j = 0; j < bus->sensor_count; j++, sensor_id++) {
+      devices->rom[sensor_id] = bus->sensors[j].address;
+      devices->idx[sensor_id] = bus->sensors[j].idx;
+      devices->period[sensor_id] = bus->sensors[j].period;
+      devices->resolution[sensor_id] = bus->sensors[j].resolution;
+      devices->bus[sensor_id] = i;
+      devices->ready[sensor_id] = false;
+
+      // Settings changed by command since the last power-on
+      const command_override_t *override =
+          command_get_override(devices->rom[sensor_id]);
+      if (override != NULL && override->period > 0) {
+        devices->period[sensor_id] = override->period;
+      }
+      if (override != NULL && override->resolution > 0) {
+        devices->resolution[sensor_id] = override->resolution;
+      }
+    }
+  }
+}
 
-  int current_sensor_reading_idx = 0;
-  for (int i = 0; i < state->num_buses; i++) {
-    for (int j = 0; j < state->onewire_config.buses[i]->sensor_count; j++) {
-      sensor_config_t *sensor = state->onewire_config.buses[i]->sensors[j];
-      current_sensor_reading_idx =
-          i * state->onewire_config.buses[i]->sensor_count + j;
+/**
+ * Returns the end of the run of sensors sharing the bus of `first`.
+ */
+static int bus_run_end(app_state_t *state, int first) {
+  int last = first + 1;
+  while (last < state->num_sensors &&
+         state->devices.bus[last] == state->devices.bus[first]) {
+    last++;
+  }
+  return last;
+}
 
-      onewire_device_t device;
-      ds18b20_device_handle_t sensor_handle;
+/**
+ * Gives a sensor its configured resolution. The bus of the sensor must be
+ * attached.
+ */
+static void apply_resolution(app_state_t *state, int sensor_id) {
+  onewire_device_t device = sensor_device(state, sensor_id);
+  int resolution = state->devices.resolution[sensor_id];
+  esp_err_t err = resolution_apply(&device, resolution);
+#ifdef CONFIG_ESP_ADAPTIVE_RESOLUTION
+  if (err == ESP_OK) {
+    // The scratchpad may still hold the resolution of the last cycle
+    err = sensor_set_resolution(&device, resolution);
+  }
+#endif
+  if (err == ESP_OK) {
+    state->sensor_readings[sensor_id].resolution = resolution;
+  } else {
+    ESP_LOGW(TAG, "Failed to apply resolution to sensor %d: %s",
+             state->devices.idx[sensor_id], esp_err_to_name(err));
+  }
+}
 
-      esp_err_t err = init_onewire_device(
-          state->bus_handles[i], strtoull(sensor->address, NULL, 16), &device);
-      if (err != ESP_OK) {
-        app_append_error(state, 3, "Failed to initialize 1-Wire device");
-        // Skip to the next sensor
+void init_sensor_pool(app_state_t *state) {
+  ESP_LOGI(TAG, "Creating the sensor handle pool");
+
+  device_table_t *devices = &state->devices;
+
+  resolution_init();
+  build_device_table(state);
+  // The publish path only looks the topics up
+  topics_build(&state->mqtt_config, devices, state->num_sensors);
+
+  for (int first = 0, last; first < state->num_sensors; first = last) {
+    int bus = devices->bus[first];
+    bool attached = attach_bus(state, bus) == ESP_OK;
+    last = bus_run_end(state, first);
+
+    for (int sensor_id = first; sensor_id < last; sensor_id++) {
+      // Slowest conversion until the resolution is known
+      state->sensor_readings[sensor_id].resolution = 12;
+
+      if ((devices->rom[sensor_id] & 0xFF) != DS18B20_FAMILY_CODE) {
+        ESP_LOGE(TAG, "Sensor %d (%016llX) is not a DS18B20",
+                 devices->idx[sensor_id], devices->rom[sensor_id]);
+        app_append_error(state, 4, "Failed to initialize sensor device");
         continue;
       }
+      devices->ready[sensor_id] = true;
 
-      err = init_ds18b20_sensor(state->bus_handles[i],
-                                strtoull(sensor->address, NULL, 16), &device,
-                                &sensor_handle);
-      if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to initialize sensor device");
-        app_append_error(state, 4, "Failed to initialize sensor device");
-        // Skip to the next sensor
+      if (!attached) {
         continue;
       }
 
-      // Trigger a temperature conversion on the sensor
-      err = ds18b20_trigger_temperature_conversion(sensor_handle);
+      apply_resolution(state, sensor_id);
+    }
 
-      if (err != ESP_OK) {
-        app_append_error(state, 5,
-                         "Failed to trigger temperature conversion on sensor");
+    detach_bus(state, bus);
+  }
 
-        // Skip to the next sensor
-        continue;
+  if (resolution_save() != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to store the verified resolutions");
+  }
+
+  ESP_LOGI(TAG, "Sensor handle pool created");
+}
+
+/**
+ * Returns the sampling period of a sensor, faulted and missing sensors are
+ * only probed now and then.
+ */
+static int sensor_period(app_state_t *state, int sensor_id) {
+  int period = state->devices.period[sensor_id];
+  if (health_is_excluded(sensor_id) &&
+      period < CONFIG_ESP_HEALTH_PROBE_INTERVAL) {
+    period = CONFIG_ESP_HEALTH_PROBE_INTERVAL;
+  }
+  return period;
+}
+
+/**
+ * Resets the reading of a sensor and tells whether it should be read this
+ * cycle. A sensor that is due gets its next deadline and, in adaptive mode,
+ * the resolution it converts at.
+ */
+static bool prepare_sensor(app_state_t *state, int sensor_id, time_t now) {
+  device_table_t *devices = &state->devices;
+  sensor_reading_t *reading = &state->sensor_readings[sensor_id];
+
+  reading->idx = devices->idx[sensor_id];
+  reading->valid = false;
+  reading->spread = 0;
+
+  if (!devices->ready[sensor_id]) {
+    // The sensor could not be set up, already reported at init
+    return false;
+  }
+
+  if (!scheduler_is_due(sensor_id, now)) {
+    return false;
+  }
+
+  // A failed reading waits for the next period as well
+  scheduler_mark_done(sensor_id, sensor_period(state, sensor_id), now);
+
+#ifdef CONFIG_ESP_ADAPTIVE_RESOLUTION
+  int resolution =
+      adaptive_select(sensor_id, devices->resolution[sensor_id]);
+  if (resolution != reading->resolution) {
+    // Scratchpad only, the EEPROM keeps the configured resolution
+    onewire_device_t device = sensor_device(state, sensor_id);
+    esp_err_t err = sensor_set_resolution(&device, resolution);
+    if (err == ESP_OK) {
+      reading->resolution = resolution;
+    } else {
+      ESP_LOGW(TAG, "Failed to set sensor %d to %d bits",
+               devices->idx[sensor_id], resolution);
+    }
+  }
+#endif
+
+  return true;
+}
+
+/**
+ * Checks the health of a reading and, if it is accepted, marks it as taken.
+ */
+static void complete_reading(app_state_t *state, int sensor_id, int16_t raw,
+                             time_t now) {
+  sensor_reading_t *reading = &state->sensor_readings[sensor_id];
+
+  if (!health_check_reading(sensor_id, raw, now)) {
+    ESP_LOGW(TAG, "Sensor %d reading %.2f C rejected",
+             state->devices.idx[sensor_id], raw / 16.0f);
+    return;
+  }
+
+  lock_readings();
+  reading->temperature = raw / 16.0f;
+  reading->valid = true;
+  unlock_readings();
+#ifdef CONFIG_ESP_ADAPTIVE_RESOLUTION
+  adaptive_update(sensor_id, reading->temperature,
+                  state->devices.resolution[sensor_id]);
+#endif
+
+  ESP_LOGI(TAG, "Sensor %d temperature: %.2f C (%d bits)",
+           state->devices.idx[sensor_id], reading->temperature,
+           reading->resolution);
+
+#ifdef CONFIG_ESP_PIPELINE
+  // Published by the network task while the next sensors are read
+  pipeline_push(sensor_id, reading);
+#endif
+}
+
+/**
+ * Waits at least `us` microseconds, a conversion read early returns the
+ * previous result. The delay is rounded up to whole ticks, plus one as the
+ * current tick may be about to end.
+ */
+static void delay_us(int64_t us) {
+  if (us > 0) {
+    vTaskDelay((us * configTICK_RATE_HZ + 999999) / 1000000 + 1);
+  }
+}
+
+/**
+ * Reads the last conversion of a sensor from its scratchpad, checking the
+ * CRC, and counts the outcome in the sensor statistics.
+ */
+static esp_err_t read_raw_temperature(app_state_t *state, int sensor_id,
+                                      int16_t *raw) {
+  uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+  onewire_device_t device = sensor_device(state, sensor_id);
+
+  esp_err_t err = sensor_read_scratchpad(&device, scratchpad);
+  sensor_stats_record(sensor_id, err);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  *raw = sensor_scratchpad_temperature(
+      scratchpad, state->sensor_readings[sensor_id].resolution);
+  return ESP_OK;
+}
+
+#ifdef CONFIG_ESP_OVERSAMPLING
+
+static int16_t s_samples[CONFIG_ESP_MAX_SENSORS]
+                        [CONFIG_ESP_OVERSAMPLING_COUNT]; ///< Burst samples
+static uint8_t s_sample_counts[CONFIG_ESP_MAX_SENSORS];   ///< Samples taken
+
+static void wait_until(int64_t deadline_us) {
+  delay_us(deadline_us - esp_timer_get_time());
+}
+
+/**
+ * Reads the due sensors of a bus with a burst of broadcast conversions.
+ *
+ * The next conversion is started before the scratchpads of the previous one
+ * are read, so the reads overlap the conversion window instead of adding to
+ * it. The scratchpad keeps the previous result until a conversion ends, so
+ * the reads have to fit in one window; sensors read late on a long bus may
+ * return the next sample instead, which is still a valid sample. Sensors in
+ * parasitic power mode cannot answer during a conversion and are not
+ * supported in this mode.
+ */
+static void read_bus(app_state_t *state, int bus, int first, int last,
+                     time_t now) {
+  static bool due[CONFIG_ESP_MAX_SENSORS]; // Too large for the stack
+  float conversion_time = 0;
+  int num_due = 0;
+
+  for (int sensor_id = first; sensor_id < last; sensor_id++) {
+    due[sensor_id] = prepare_sensor(state, sensor_id, now);
+    if (!due[sensor_id]) {
+      continue;
+    }
+
+    num_due++;
+    s_sample_counts[sensor_id] = 0;
+
+    // Every sensor converts, the slowest one sets the window
+    float time = ds18b20_max_conversion_time_ms(
+        int_to_resolution(state->sensor_readings[sensor_id].resolution));
+    if (time > conversion_time) {
+      conversion_time = time;
+    }
+  }
+
+  if (num_due == 0) {
+    return;
+  }
+
+  int64_t window_us = conversion_time * 1000;
+  int64_t started = esp_timer_get_time();
+  if (sensor_broadcast_conversion(state->bus_handles[bus]) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to trigger temperature conversion on bus %d", bus);
+    for (int sensor_id = first; sensor_id < last; sensor_id++) {
+      if (due[sensor_id]) {
+        health_record_failure(sensor_id);
       }
+    }
+    return;
+  }
 
-      // Wait for the conversion to complete
-      float max_conversion_time =
-          ds18b20_max_conversion_time_ms(int_to_resolution(sensor->resolution));
-      ESP_LOGD(TAG, "Waiting for temperature conversion to complete (%.2f ms)",
-               max_conversion_time);
-      vTaskDelay(max_conversion_time / portTICK_PERIOD_MS);
+  for (int k = 0; k < CONFIG_ESP_OVERSAMPLING_COUNT; k++) {
+    wait_until(started + window_us);
 
-      // Read the temperature from the sensor
+    if (k + 1 < CONFIG_ESP_OVERSAMPLING_COUNT) {
+      started = esp_timer_get_time();
+      if (sensor_broadcast_conversion(state->bus_handles[bus]) != ESP_OK) {
+        ESP_LOGW(TAG, "Burst on bus %d stopped after %d conversions", bus,
+                 k + 1);
+        k = CONFIG_ESP_OVERSAMPLING_COUNT - 1; // Read this one and stop
+      }
+    }
 
-      sensor_reading_t *reading =
-          &state->sensor_readings[current_sensor_reading_idx];
+    for (int sensor_id = first; sensor_id < last; sensor_id++) {
+      int16_t raw;
 
-      reading->idx = sensor->idx;
-      err = ds18b20_get_temperature(sensor_handle, &reading->temperature);
+      if (due[sensor_id] &&
+          read_raw_temperature(state, sensor_id, &raw) == ESP_OK) {
+        s_samples[sensor_id][s_sample_counts[sensor_id]++] = raw;
+      }
+    }
+  }
 
-      if (err != ESP_OK) {
-        app_append_error(state, 5, "Failed to read sensor temperature");
+  // Sensors without a sample still hold the last conversion, read it again
+  for (int sensor_id = first; sensor_id < last; sensor_id++) {
+    bool retry = due[sensor_id] && !health_is_excluded(sensor_id);
+    for (int attempt = 0; retry && s_sample_counts[sensor_id] == 0 &&
+                          attempt < CONFIG_ESP_SENSOR_READ_RETRIES;
+         attempt++) {
+      int16_t raw;
+      sensor_stats_record_retry(sensor_id);
+      if (read_raw_temperature(state, sensor_id, &raw) == ESP_OK) {
+        s_samples[sensor_id][s_sample_counts[sensor_id]++] = raw;
       }
+    }
+  }
 
-      // Log the sensor reading
-      ESP_LOGI(TAG, "Sensor %d temperature: %.2f C", sensor->idx,
-               reading->temperature);
+  for (int sensor_id = first; sensor_id < last; sensor_id++) {
+    sensor_reading_t *reading = &state->sensor_readings[sensor_id];
 
-#ifdef CONFIG_ESP_SLEEP_MODE
-      err = ds18b20_del_device(sensor_handle);
-      if (err != ESP_OK) {
-        app_append_error(state, 6, "Failed to deinitialize sensor device");
+    if (!due[sensor_id]) {
+      continue;
+    }
+
+    if (s_sample_counts[sensor_id] == 0) {
+      ESP_LOGW(TAG, "Failed to read sensor %d", state->devices.idx[sensor_id]);
+      health_record_failure(sensor_id);
+      continue;
+    }
+
+    int16_t value = oversampling_reduce(
+        s_samples[sensor_id], s_sample_counts[sensor_id], &reading->spread);
+    complete_reading(state, sensor_id, value, now);
+  }
+}
+
+#endif // CONFIG_ESP_OVERSAMPLING
+
+#ifndef CONFIG_ESP_OVERSAMPLING
+
+/**
+ * Converts and reads a sensor. `*convert` is cleared once the conversion
+ * succeeded, so a retry only repeats what failed.
+ */
+static esp_err_t convert_and_read(app_state_t *state, int sensor_id,
+                                  bool *convert, int16_t *raw) {
+  esp_err_t err;
+
+  if (*convert) {
+    // Trigger a temperature conversion on the sensor
+    onewire_device_t device = sensor_device(state, sensor_id);
+    err = sensor_trigger_conversion(&device);
+    if (err != ESP_OK) {
+      sensor_stats_record_error(sensor_id, err);
+      return err;
+    }
+    *convert = false;
+
+    // Wait for the conversion to complete
+    float max_conversion_time = ds18b20_max_conversion_time_ms(
+        int_to_resolution(state->sensor_readings[sensor_id].resolution));
+    ESP_LOGD(TAG, "Waiting for temperature conversion to complete (%.2f ms)",
+             max_conversion_time);
+    delay_us((int64_t)(max_conversion_time * 1000.0f));
+  }
+
+  // Read the temperature from the sensor
+  return read_raw_temperature(state, sensor_id, raw);
+}
+
+/**
+ * Reads the due sensors of a bus one after the other. Failed sensors are
+ * queued and retried once the rest of the bus is done.
+ */
+static void read_bus(app_state_t *state, int bus, int first, int last,
+                     time_t now) {
+  // Too large for the stack with many sensors
+  static int retry_queue[CONFIG_ESP_MAX_SENSORS];
+  static bool convert[CONFIG_ESP_MAX_SENSORS];
+  int num_queued = 0;
+
+  for (int sensor_id = first; sensor_id < last; sensor_id++) {
+    if (!prepare_sensor(state, sensor_id, now)) {
+      continue;
+    }
+
+    int16_t raw;
+    convert[sensor_id] = true;
+    if (convert_and_read(state, sensor_id, &convert[sensor_id], &raw) ==
+        ESP_OK) {
+      complete_reading(state, sensor_id, raw, now);
+    } else if (health_is_excluded(sensor_id)) {
+      // Probing a faulted or missing sensor, one attempt is enough
+      health_record_failure(sensor_id);
+    } else {
+      retry_queue[num_queued++] = sensor_id;
+    }
+  }
+
+  for (int attempt = 0;
+       attempt < CONFIG_ESP_SENSOR_READ_RETRIES && num_queued > 0; attempt++) {
+    int num_failed = 0;
+
+    for (int q = 0; q < num_queued; q++) {
+      int sensor_id = retry_queue[q];
+      int16_t raw;
+
+      ESP_LOGW(TAG, "Retrying sensor %d", state->devices.idx[sensor_id]);
+      sensor_stats_record_retry(sensor_id);
+      if (convert_and_read(state, sensor_id, &convert[sensor_id], &raw) ==
+          ESP_OK) {
+        complete_reading(state, sensor_id, raw, now);
+      } else {
+        retry_queue[num_failed++] = sensor_id;
       }
+    }
+
+    num_queued = num_failed;
+  }
+
+  for (int q = 0; q < num_queued; q++) {
+    int sensor_id = retry_queue[q];
+    ESP_LOGW(TAG, "%s sensor %d",
+             convert[sensor_id] ? "Failed to trigger temperature conversion on"
+                                : "Failed to read",
+             state->devices.idx[sensor_id]);
+    health_record_failure(sensor_id);
+  }
+}
+
+#endif // CONFIG_ESP_OVERSAMPLING
+
+void read_sensors(app_state_t *state) {
+  ESP_LOGI(TAG, "Reading the sensors");
+
+  time_t now = time(NULL);
+
+  // One slot per bus, buses without sensors are not even attached
+  for (int first = 0, last; first < state->num_sensors; first = last) {
+    int bus = state->devices.bus[first];
+    last = bus_run_end(state, first);
+
+    if (attach_bus(state, bus) == ESP_OK) {
+      read_bus(state, bus, first, last, now);
+      detach_bus(state, bus);
+      continue;
+    }
+
+    app_append_error(state, 2, "Failed to attach 1-Wire bus");
+    // Tried again next period rather than on every wake
+    for (int sensor_id = first; sensor_id < last; sensor_id++) {
+      if (state->devices.ready[sensor_id] &&
+          scheduler_is_due(sensor_id, now)) {
+        scheduler_mark_done(sensor_id, sensor_period(state, sensor_id), now);
+      }
+    }
+  }
+}
+
+/**
+ * Formats the JSON message of a reading.
+ *
+ * Returns the length of the message, -1 if it does not fit.
+ */
+static int format_reading(app_state_t *state, int sensor,
+                          const sensor_reading_t *reading,
+                          char reading_str[MAX_PAYLOAD_LENGTH]) {
+  int length;
+
+#ifdef CONFIG_ESP_MQTT_DOMOTICZ_INTEGRATION
+  length = snprintf(
+      reading_str, MAX_PAYLOAD_LENGTH,
+      "{\"command\":\"udevice\", \"idx\":%d, \"svalue\":\"%.2f\", "
+      "\"resolution\":%d",
+      reading->idx, reading->temperature, reading->resolution);
+#else
+  length = snprintf(
+      reading_str, MAX_PAYLOAD_LENGTH,
+      "{\"address\":\"%016llX\", \"idx\":%d, \"temperature\":%.2f, "
+      "\"resolution\":%d",
+      state->devices.rom[sensor], reading->idx, reading->temperature,
+      reading->resolution);
+#endif
+
+#ifdef CONFIG_ESP_OVERSAMPLING
+  if (length < MAX_PAYLOAD_LENGTH) {
+    length += snprintf(reading_str + length, MAX_PAYLOAD_LENGTH - length,
+                       ", \"spread\":%.2f", reading->spread / 16.0);
+  }
+#endif
+
+  if (length >= MAX_PAYLOAD_LENGTH - 1) {
+    ESP_LOGE(TAG, "Reading payload too long");
+    return -1;
+  }
+  strcat(reading_str, "}");
+
+  return length + 1;
+}
+
+/**
+ * CBOR message being filled for each broker using that format.
+ */
+static payload_cbor_t s_messages[CONFIG_ESP_MAX_BROKERS];
+
+/**
+ * Where the readings of each CBOR message come from, see `BACKLOG_SOURCE()`.
+ */
+static int16_t s_sources[CONFIG_ESP_MAX_BROKERS][PAYLOAD_CBOR_MAX_READINGS];
+
+/**
+ * The source of a reading kept in the backlog at `position`. The readings of
+ * this cycle have the index of their sensor as source.
+ */
+#define BACKLOG_SOURCE(position) (-1 - (position))
+
+/**
+ * Readings some broker could not take, published again next cycle.
+ */
+typedef struct {
+  bool backlog[CONFIG_ESP_BACKLOG_SIZE]; ///< Kept readings, by position
+  bool sensors[CONFIG_ESP_MAX_SENSORS];  ///< Readings of this cycle
+} deferral_t;
+
+static void defer_source(deferral_t *deferral, int source) {
+  if (source >= 0) {
+    deferral->sensors[source] = true;
+  } else {
+    deferral->backlog[-1 - source] = true;
+  }
+}
+
+/**
+ * Defers every reading, for a broker that could not be reached at all.
+ */
+static void defer_all(deferral_t *deferral) {
+  memset(deferral, true, sizeof(*deferral));
+}
+
+/**
+ * Tells whether a reading that failed to publish is worth another try in the
+ * next cycle: the broker was congested or refused it, but the reading itself
+ * can be published.
+ */
+static bool is_deferred(esp_err_t err) {
+  return err == ESP_ERR_TIMEOUT || err == ESP_FAIL;
+}
+
+/**
+ * Starts the readings of a cycle for a broker.
+ */
+static void begin_readings(app_state_t *state, int broker) {
+  if (state->mqtt_config.brokers[broker].format == MQTT_PAYLOAD_CBOR) {
+    payload_cbor_begin(&s_messages[broker]);
+  }
+}
+
+/**
+ * Publishes the readings batched for a broker, if any. When the broker does
+ * not take the message, its readings are deferred.
+ */
+static esp_err_t flush_readings(app_state_t *state, MQTT_Client *mqtt_client,
+                                int broker, deferral_t *deferral) {
+  mqtt_broker_config_t *config = &state->mqtt_config.brokers[broker];
+  payload_cbor_t *message = &s_messages[broker];
+
+  if (config->format != MQTT_PAYLOAD_CBOR) {
+    return ESP_OK;
+  }
+  size_t length = payload_cbor_end(message);
+  if (length == 0) {
+    return ESP_OK;
+  }
+
+  mqtt_message_info_t info = {.timestamp = time(NULL)};
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+  info.expiry = CONFIG_ESP_MQTT_MESSAGE_EXPIRY;
+#endif
+  esp_err_t err = mqtt_publish_data(mqtt_client, config->topic, message->data,
+                                    length, config->retain, &info);
+  if (err == ESP_OK) {
+    payload_count(mqtt_client->packet_size, message->json_bytes);
+  } else if (is_deferred(err)) {
+    for (int i = 0; i < message->count; i++) {
+      defer_source(deferral, s_sources[broker][i]);
+    }
+  }
+  payload_cbor_begin(message);
+  return err;
+}
+
+/**
+ * At QoS 1, waits until the broker acknowledged the readings, the outbox is
+ * lost with the client. Readings some broker may not have received are
+ * published again next cycle.
+ */
+static void wait_acknowledged(MQTT_Client *mqtt_client, deferral_t *deferral) {
+#if CONFIG_ESP_MQTT_READINGS_QOS > 0
+  if (mqtt_wait_acknowledged(mqtt_client) != ESP_OK) {
+    defer_all(deferral);
+  }
+#endif
+}
+
+/**
+ * Describes a reading for the MQTT 5 properties of its message. `sampled` is
+ * 0 for a reading of this cycle. Returns false when the reading expired, the
+ * broker would drop it anyway.
+ */
+static bool describe_reading(int sensor, time_t sampled,
+                             mqtt_message_info_t *info) {
+  time_t now = time(NULL);
+
+  *info = (mqtt_message_info_t){.timestamp = sampled > 0 ? sampled : now};
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+  // The health of the sensor when a kept reading was sampled is not known
+  if (sampled == 0) {
+    info->quality = health_state_name(health_get_state(sensor));
+  }
+#if CONFIG_ESP_MQTT_MESSAGE_EXPIRY > 0
+  time_t age = now > info->timestamp ? now - info->timestamp : 0;
+  if (age >= CONFIG_ESP_MQTT_MESSAGE_EXPIRY) {
+    return false;
+  }
+  info->expiry = CONFIG_ESP_MQTT_MESSAGE_EXPIRY - age;
+#endif
+#endif
+  return true;
+}
+
+/**
+ * Publishes a reading to a broker, in the format of the broker. CBOR readings
+ * are batched until `flush_readings()`, or until the message is full.
+ * `source` is the sensor of a reading of this cycle, or `BACKLOG_SOURCE()` of
+ * a kept reading. A reading of this cycle is given as `reading`, or taken
+ * from the readings when NULL. A reading the broker does not take is
+ * deferred.
+ */
+static esp_err_t publish_reading(app_state_t *state, MQTT_Client *mqtt_client,
+                                 int broker, int source,
+                                 const sensor_reading_t *reading,
+                                 deferral_t *deferral) {
+  mqtt_broker_config_t *config = &state->mqtt_config.brokers[broker];
+  char reading_str[MAX_PAYLOAD_LENGTH];
+  mqtt_message_info_t info;
+  time_t sampled;
+  int sensor;
+
+  if (source >= 0) {
+    sensor = source;
+    if (reading == NULL) {
+      reading = &state->sensor_readings[sensor];
+    }
+    sampled = 0;
+  } else {
+    const backlog_entry_t *entry = backlog_get(-1 - source);
+    sensor = entry->sensor;
+    reading = &entry->reading;
+    sampled = entry->timestamp;
+  }
+
+  const char *topic = topics_get(broker, sensor);
+
+  if (topic == NULL || topic[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!describe_reading(sensor, sampled, &info)) {
+    ESP_LOGD(TAG, "Dropping expired reading of sensor %d", sensor);
+    return ESP_OK;
+  }
+  int length = format_reading(state, sensor, reading, reading_str);
+  if (length < 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint32_t json_bytes = mqtt_packet_size(topic, length);
+
+  if (config->format == MQTT_PAYLOAD_JSON) {
+    esp_err_t err = mqtt_publish_data(mqtt_client, topic, reading_str, length,
+                                      config->retain, &info);
+    if (err == ESP_OK) {
+      payload_count(mqtt_client->packet_size, json_bytes);
+    } else if (is_deferred(err)) {
+      defer_source(deferral, source);
+    }
+    return err;
+  }
+
+  payload_cbor_t *message = &s_messages[broker];
+  uint64_t rom = state->devices.rom[sensor];
+  if (!payload_cbor_add(message, rom, reading, json_bytes)) {
+    // Full, its readings are deferred if it fails
+    flush_readings(state, mqtt_client, broker, deferral);
+    payload_cbor_add(message, rom, reading, json_bytes);
+  }
+  s_sources[broker][message->count - 1] = source;
+  return ESP_OK;
+}
+
+/**
+ * Keeps a reading in the backlog for the next cycle. The readings must be
+ * locked.
+ */
+static void keep_reading(int sensor, sensor_reading_t *reading) {
+  if (!backlog_push(sensor, reading)) {
+    pacing_count_dropped(1);
+  }
+  reading->valid = false;
+}
+
+/**
+ * Drops the kept readings that were published, keeping those a broker
+ * deferred for the next cycle. The readings must be locked.
+ */
+static void keep_deferred_backlog(const bool *deferred) {
+  int count = 0;
+  for (int i = 0; i < backlog_count(); i++) {
+    count += deferred[i];
+  }
+
+  if (count > 0) {
+    ESP_LOGW(TAG, "Keeping %d deferred readings for the next cycle", count);
+    pacing_count_deferred(count);
+  }
+  backlog_keep(deferred);
+}
+
+/**
+ * Keeps the readings of this cycle that were not sent yet for the next cycle.
+ * The readings must be locked.
+ */
+static void keep_unsent_readings(app_state_t *state) {
+  int count = count_valid_readings(state);
+  if (count > 0) {
+    ESP_LOGI(TAG, "Keeping %d sensor readings for the next cycle", count);
+  }
+
+  for (int i = 0; i < state->num_sensors; i++) {
+    if (state->sensor_readings[i].valid) {
+      keep_reading(i, &state->sensor_readings[i]);
+    }
+  }
+}
+
+/**
+ * Settles the readings once every broker had its chance: those a broker
+ * deferred are kept for the next cycle, the others are done with. Until then,
+ * an overrun keeps them all.
+ */
+static void settle_readings(app_state_t *state, const deferral_t *deferral) {
+  lock_readings();
+  keep_deferred_backlog(deferral->backlog);
+  for (int i = 0; i < state->num_sensors; i++) {
+    if (!state->sensor_readings[i].valid) {
+      continue;
+    }
+    if (deferral->sensors[i]) {
+      pacing_count_deferred(1);
+      keep_reading(i, &state->sensor_readings[i]);
+    } else {
+      state->sensor_readings[i].valid = false;
+    }
+  }
+  unlock_readings();
+}
+
+/**
+ * Connects a client to its broker, unless its session is still open from a
+ * previous cycle. A session that was lost is dropped and opened again.
+ */
+static esp_err_t open_session(app_state_t *state, MQTT_Client *mqtt_client,
+                              mqtt_broker_config_t *broker) {
+  mqtt_client->broker = broker - state->mqtt_config.brokers;
+  pacing_begin(mqtt_client->broker);
+  if (mqtt_is_connected(mqtt_client)) {
+    ESP_LOGD(TAG, "Reusing the session with MQTT broker %s", broker->host);
+    return ESP_OK;
+  }
+  mqtt_stop(mqtt_client);
+
+  esp_err_t err = mqtt_init(mqtt_client, broker);
+  if (err != ESP_OK) {
+    app_append_error(state, 6, "Failed to initialize MQTT client");
+    return err;
+  }
+  ESP_LOGI(TAG, "Connecting to MQTT broker %s", broker->host);
+  begin_phase(SUPERVISOR_PHASE_CONNECT);
+  err = mqtt_start(mqtt_client);
+  end_phase();
+  if (err != ESP_OK) {
+    app_append_error(state, 7, "Failed to connect to MQTT broker");
+    mqtt_stop(mqtt_client);
+  }
+  return err;
+}
+
+/**
+ * Changes the sampling period or the resolution of the sensors a command
+ * targets. The new settings outlive deep sleep, not a power-on reset.
+ */
+static void apply_setting(app_state_t *state, const command_t *command) {
+  device_table_t *devices = &state->devices;
+  time_t now = time(NULL);
+  bool found = false;
+
+  for (int i = 0; i < state->num_sensors; i++) {
+    if (command->target >= 0 && command->target != devices->idx[i]) {
+      continue;
+    }
+    found = true;
+
+    if (command->type == COMMAND_INTERVAL) {
+      command_set_override(devices->rom[i], command->value, 0);
+      devices->period[i] = command->value;
+      scheduler_limit(i, command->value, now);
+      continue;
+    }
+
+    command_set_override(devices->rom[i], 0, command->value);
+    if (devices->resolution[i] == command->value) {
+      continue;
+    }
+    devices->resolution[i] = command->value;
+    if (devices->ready[i] && attach_bus(state, devices->bus[i]) == ESP_OK) {
+      apply_resolution(state, i);
+      detach_bus(state, devices->bus[i]);
+    }
+  }
+
+  if (!found) {
+    ESP_LOGW(TAG, "No sensor with idx %d", command->target);
+  }
+  if (command->type == COMMAND_RESOLUTION && resolution_save() != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to store the verified resolutions");
+  }
+}
+
+static void apply_command(app_state_t *state, MQTT_Client *mqtt_client,
+                          const command_t *command) {
+  switch (command->type) {
+  case COMMAND_INTERVAL:
+  case COMMAND_RESOLUTION:
+    apply_setting(state, command);
+    return;
+  case COMMAND_READ:
+    // Every sensor is due, the next wake comes right away
+    scheduler_reset();
+    break;
+  case COMMAND_REDISCOVER:
+#ifdef CONFIG_ESP_AUTO_DISCOVERY
+    discovery_request(command->target);
+#else
+    ESP_LOGW(TAG, "Rediscovery requires ESP_AUTO_DISCOVERY");
 #endif
+    break;
+  case COMMAND_STATS:
+    telemetry_publish_sensor_stats(mqtt_client, &state->devices,
+                                   state->num_sensors, true);
+    break;
+  }
+
+  // One-shot commands must not run again at every wake
+  command_clear_retained(mqtt_client, command);
+}
+
+/**
+ * Applies the commands received by a client. Waits up to
+ * `CONFIG_ESP_MQTT_COMMAND_WAIT` ms, so the retained commands the broker sends
+ * after the subscription are picked up on the wake they were published for.
+ */
+static void apply_commands(app_state_t *state, MQTT_Client *mqtt_client) {
+  if (mqtt_client->commands == NULL) {
+    return;
+  }
+
+  int64_t deadline_us =
+      esp_timer_get_time() + CONFIG_ESP_MQTT_COMMAND_WAIT * 1000LL;
+  command_t command;
+  for (;;) {
+    int64_t left_us = deadline_us - esp_timer_get_time();
+    TickType_t wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) : 0;
+    if (!command_next(mqtt_client->commands, &command, wait)) {
+      break;
     }
+    apply_command(state, mqtt_client, &command);
   }
 }
 
 void publish_sensor_readings(app_state_t *state) {
   ESP_LOGI(TAG, "Publishing sensor readings to MQTT brokers");
 
+  int published = 0;
+  bool settled = false;
+  static deferral_t deferral; // Too large for the stack
+  static bool unsent_events[CONFIG_ESP_MAX_SENSORS];
+  memset(&deferral, 0, sizeof(deferral));
+  memset(unsent_events, 0, sizeof(unsent_events));
   for (int i = 0; i < state->mqtt_config.broker_count; i++) {
     mqtt_broker_config_t *broker = &state->mqtt_config.brokers[i];
-    MQTT_Client mqtt_client;
-    esp_err_t err = mqtt_init(&mqtt_client, broker);
-    if (err != ESP_OK) {
-      app_append_error(state, 6, "Failed to initialize MQTT client");
-      // Skip to the next broker
-      continue;
-    }
-    ESP_LOGI(TAG, "Connecting to MQTT broker %s", broker->host);
-    err = mqtt_start(&mqtt_client);
-    if (err != ESP_OK) {
-      app_append_error(state, 7, "Failed to connect to MQTT broker");
-      // Skip to the next broker
+#ifdef CONFIG_ESP_LIGHT_SLEEP
+    // The session stays open while the device is idle in light sleep
+    MQTT_Client *mqtt_client = &state->mqtt_clients[i];
+#else
+    MQTT_Client session = {0};
+    MQTT_Client *mqtt_client = &session;
+#endif
+    if (open_session(state, mqtt_client, broker) != ESP_OK) {
+      // Skip to the next broker, it gets the readings next cycle
+      defer_all(&deferral);
       continue;
     }
     ESP_LOGI(TAG, "Publishing sensor readings to topic %s", broker->topic);
+    begin_phase(SUPERVISOR_PHASE_PUBLISH);
+
+#ifdef CONFIG_ESP_HOMEASSISTANT_DISCOVERY
+    // Only after the sensors or the topics changed
+    homeassistant_publish(mqtt_client, i, broker, &state->devices,
+                          state->num_sensors);
+#endif
+
+    // Readings kept while the network was unreachable go first
+    begin_readings(state, i);
+    for (int j = 0; j < backlog_count(); j++) {
+      publish_reading(state, mqtt_client, i, BACKLOG_SOURCE(j), NULL,
+                      &deferral);
+    }
 
     for (int j = 0; j < state->num_sensors; j++) {
-      char *reading_str;
+      if (state->sensor_readings[j].valid) {
+        publish_reading(state, mqtt_client, i, j, NULL, &deferral);
+      }
+    }
+    flush_readings(state, mqtt_client, i, &deferral);
+    wait_acknowledged(mqtt_client, &deferral);
+    if (i == state->mqtt_config.broker_count - 1) {
+      // Sent, an overrun past this point must not keep them again
+      settle_readings(state, &deferral);
+      settled = true;
+    }
 
-#ifdef CONFIG_ESP_MQTT_DOMOTICZ_INTEGRATION
-      asprintf(&reading_str,
-               "{\"command\":\"udevice\", \"idx\":%d, \"svalue\":\"%.2f\"}",
-               state->sensor_readings[j].idx,
-               state->sensor_readings[j].temperature);
-#else
-      asprintf(&reading_str,
-               "{\"address\":\"%s\", \"idx\":%d, \"temperature\":%.2f}",
-               state->onewire_config.buses[j]->sensors[j]->address,
-               state->sensor_readings[j].idx,
-               state->sensor_readings[j].temperature);
+    telemetry_publish(mqtt_client);
+    telemetry_publish_sensor_stats(mqtt_client, &state->devices,
+                                   state->num_sensors, false);
+    telemetry_publish_health_events(mqtt_client, &state->devices,
+                                    state->num_sensors, unsent_events);
+    end_phase();
+
+    apply_commands(state, mqtt_client);
+#ifndef CONFIG_ESP_LIGHT_SLEEP
+    mqtt_stop(mqtt_client);
 #endif
+    published++;
+  }
+
+  if (published == 0) {
+    // No broker could be reached, keep the readings for the next cycle
+    store_sensor_readings(state);
+    return;
+  }
+  if (!settled) {
+    settle_readings(state, &deferral);
+  }
+  // Transitions some broker refused are published again next cycle
+  health_clear_events(unsent_events);
+}
+
+void store_sensor_readings(app_state_t *state) {
+  lock_readings();
+  keep_unsent_readings(state);
+  unlock_readings();
+}
 
-      mqtt_publish(&mqtt_client, broker, reading_str);
-      free(reading_str);
+#ifdef CONFIG_ESP_PIPELINE
+static void acquisition_task(void *arg) {
+  app_state_t *state = arg;
+
+  // Timed in parallel with the phases of the main task, whose CPU frequency
+  // applies to this task as well
+  supervisor_begin_phase(SUPERVISOR_PHASE_ACQUISITION);
+  read_sensors(state);
+  supervisor_end_phase();
+  pipeline_close();
+  vTaskDelete(NULL);
+}
+
+void run_pipeline(app_state_t *state) {
+  pipeline_reset();
+
+  // This task stays on the core of the WiFi stack, the 1-Wire buses are
+  // driven from the other one
+  if (xTaskCreatePinnedToCore(acquisition_task, "acquisition",
+                              PIPELINE_ACQUISITION_STACK_SIZE, state,
+                              uxTaskPriorityGet(NULL), NULL,
+                              PIPELINE_ACQUISITION_CORE) != pdPASS) {
+    ESP_LOGW(TAG, "Failed to start the acquisition task, reading first");
+    begin_phase(SUPERVISOR_PHASE_ACQUISITION);
+    read_sensors(state);
+    end_phase();
+    pipeline_close();
+  }
+
+  // Connect while the first conversions run
+  int num_connected = 0;
+  bool connected[CONFIG_ESP_MAX_BROKERS] = {false};
+  ESP_LOGI(TAG, "Connecting to Wi-Fi");
+  begin_phase(SUPERVISOR_PHASE_CONNECT);
+  esp_err_t err = wifi_init_sta();
+  end_phase();
+  if (err != ESP_OK) {
+    app_append_error(state, 7, "Failed to connect to Wi-Fi");
+  } else {
+    for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+      connected[i] = open_session(state, &state->mqtt_clients[i],
+                                  &state->mqtt_config.brokers[i]) == ESP_OK;
+      num_connected += connected[i];
     }
   }
 
-  // Free the sensor readings
-  free(state->sensor_readings);
-  state->sensor_readings = NULL;
+  // Includes the wait for the readings of the acquisition task
+  begin_phase(SUPERVISOR_PHASE_PUBLISH);
+
+#ifdef CONFIG_ESP_HOMEASSISTANT_DISCOVERY
+  // The entities exist before their first reading arrives
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    if (connected[i]) {
+      homeassistant_publish(&state->mqtt_clients[i], i,
+                            &state->mqtt_config.brokers[i], &state->devices,
+                            state->num_sensors);
+    }
+  }
+#endif
+
+  // Readings kept while the network was unreachable go first
+  static deferral_t deferral; // Too large for the stack
+  memset(&deferral, 0, sizeof(deferral));
+  bool batched = false;
+  if (num_connected < state->mqtt_config.broker_count) {
+    // The brokers that could not be reached get the readings next cycle
+    defer_all(&deferral);
+  }
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    begin_readings(state, i);
+    for (int j = 0; connected[i] && j < backlog_count(); j++) {
+      publish_reading(state, &state->mqtt_clients[i], i, BACKLOG_SOURCE(j),
+                      NULL, &deferral);
+    }
+    batched |= connected[i] &&
+               state->mqtt_config.brokers[i].format == MQTT_PAYLOAD_CBOR;
+  }
+  // Acknowledged readings are only settled once the outbox is empty
+  batched |= CONFIG_ESP_MQTT_READINGS_QOS > 0;
+
+  // Each reading goes out as soon as its scratchpad is read
+  pipeline_entry_t entry;
+  while (pipeline_pop(&entry)) {
+    for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+      // The copy handed over by the ring, not the slot the producer writes
+      if (connected[i]) {
+        publish_reading(state, &state->mqtt_clients[i], i, entry.sensor,
+                        &entry.reading, &deferral);
+      }
+    }
+    if (num_connected > 0 && !batched && !deferral.sensors[entry.sensor]) {
+      // Sent, an overrun must not keep it again. Batched, acknowledged and
+      // deferred readings are settled below.
+      lock_readings();
+      state->sensor_readings[entry.sensor].valid = false;
+      unlock_readings();
+    }
+  }
+
+  // CBOR brokers get the readings of the cycle in one message
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    if (connected[i]) {
+      flush_readings(state, &state->mqtt_clients[i], i, &deferral);
+      wait_acknowledged(&state->mqtt_clients[i], &deferral);
+    }
+  }
+  if (num_connected > 0) {
+    settle_readings(state, &deferral);
+  } else {
+    store_sensor_readings(state);
+  }
+
+  // The acquisition is over, its statistics can be read
+  static bool unsent_events[CONFIG_ESP_MAX_SENSORS]; // Too large for the stack
+  memset(unsent_events, 0, sizeof(unsent_events));
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    MQTT_Client *mqtt_client = &state->mqtt_clients[i];
+    if (!connected[i]) {
+      continue;
+    }
+    telemetry_publish(mqtt_client);
+    telemetry_publish_sensor_stats(mqtt_client, &state->devices,
+                                   state->num_sensors, false);
+    telemetry_publish_health_events(mqtt_client, &state->devices,
+                                    state->num_sensors, unsent_events);
+  }
+  end_phase();
+
+  // The buses are free again, commands may reconfigure the sensors
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    if (!connected[i]) {
+      continue;
+    }
+    apply_commands(state, &state->mqtt_clients[i]);
+#ifndef CONFIG_ESP_LIGHT_SLEEP
+    mqtt_stop(&state->mqtt_clients[i]);
+#endif
+  }
+
+  if (num_connected > 0) {
+    // Transitions some broker refused are published again next cycle
+    health_clear_events(unsent_events);
+  }
 }
+#endif // CONFIG_ESP_PIPELINE
 #endif // CONFIG_ESP_SCANNER_MODE
 
 void log_errors(app_state_t *state) {
@@ -422,12 +1729,24 @@ void log_errors(app_state_t *state) {
     ESP_LOGE(TAG, "Error %d: %s", state->errors[i].code,
              state->errors[i].message);
   }
+  if (state->num_dropped_errors > 0) {
+    ESP_LOGE(TAG, "%d more errors not recorded", state->num_dropped_errors);
+  }
 }
 
-void free_errors(app_state_t *state) {
-  if (state->errors != NULL) {
-    free(state->errors);
+void app_reset_cycle(app_state_t *state) {
+  state->num_errors = 0;
+  state->num_dropped_errors = 0;
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+  power_begin_cycle();
+#endif
+#ifndef CONFIG_ESP_SCANNER_MODE
+  payload_begin_cycle();
+  pacing_begin_cycle();
+  for (int i = 0; i < state->num_sensors; i++) {
+    state->sensor_readings[i].valid = false;
   }
+#endif
 }
 
 void log_runtime(app_state_t *state) {
@@ -442,23 +1761,54 @@ void log_runtime(app_state_t *state) {
 #endif
 }
 
-void enter_sleep_mode() {
+void enter_sleep_mode(app_state_t *state) {
 #ifdef CONFIG_ESP_SLEEP_MODE
+  int duration = next_wake_seconds(state);
 #ifdef CONFIG_ESP_SIMULATED_DEVICE
-  ESP_LOGI(TAG, "Simulating deep sleep mode for %d seconds",
-           CONFIG_ESP_SLEEP_DURATION);
-  vTaskDelay(CONFIG_ESP_SLEEP_DURATION * 1000 / portTICK_PERIOD_MS);
+  ESP_LOGI(TAG, "Simulating deep sleep mode for %d seconds", duration);
+  vTaskDelay(duration * 1000 / portTICK_PERIOD_MS);
   esp_restart();
 #else
-  ESP_LOGI(TAG, "Entering deep sleep mode");
+  ESP_LOGI(TAG, "Entering deep sleep mode for %d seconds", duration);
+  esp_sleep_enable_timer_wakeup(duration *
+                                1000000ULL); // seconds to microseconds
   esp_deep_sleep_start();
 #endif
 #endif
 }
 
+void app_handle_overrun(supervisor_phase_t phase, void *arg) {
+  ESP_LOGE(TAG, "Wake cycle over budget (%s), forcing sleep",
+           supervisor_phase_name(phase));
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+  // Keep whatever was read and not sent so far, unless the owning task is in
+  // the middle of updating it. The lock is never given back, the device
+  // sleeps.
+  if (s_readings_lock != NULL &&
+      xSemaphoreTake(s_readings_lock,
+                     pdMS_TO_TICKS(APP_READINGS_LOCK_WAIT_MS)) == pdTRUE) {
+    keep_unsent_readings(arg);
+  } else {
+    ESP_LOGE(TAG, "Readings busy, not kept");
+  }
+#endif
+
+#ifdef CONFIG_ESP_SIMULATED_DEVICE
+  esp_restart();
+#else
+  esp_sleep_enable_timer_wakeup(next_wake_seconds(arg) *
+                                1000000ULL); // seconds to microseconds
+  esp_deep_sleep_start();
+#endif
+}
+
 void app_deinit(app_state_t *state) {
   ESP_LOGI(TAG, "Deinitializing application");
 
+  // The cycle is over, nothing left to supervise
+  supervisor_disarm();
+
   // Log the errors
   log_errors(state);
 
@@ -468,37 +1818,52 @@ void app_deinit(app_state_t *state) {
   // Deinitialize the application
   app_free_state(state);
 
+#if !defined(CONFIG_ESP_SCANNER_MODE) &&                                       \
+    (defined(CONFIG_ESP_LIGHT_SLEEP) || defined(CONFIG_ESP_PIPELINE))
+  for (int i = 0; i < state->mqtt_config.broker_count; i++) {
+    mqtt_stop(&state->mqtt_clients[i]);
+  }
+#endif
+
   // Configure the ESP32 to enter deep sleep mode
-  enter_sleep_mode();
+  enter_sleep_mode(state);
 }
 
 void app_append_error(app_state_t *state, int code, const char *message) {
+  // Errors come from the acquisition and network tasks, and the supervisor
+  static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
   app_error_t error = {
       .code = code,
       .message = message,
   };
 
-  if (state->errors == NULL) {
-    state->errors = malloc(sizeof(app_error_t));
+  portENTER_CRITICAL(&lock);
+  bool recorded = state->num_errors < CONFIG_ESP_MAX_ERRORS;
+  if (recorded) {
+    state->errors[state->num_errors] = error;
+    state->num_errors++;
   } else {
-    state->errors =
-        realloc(state->errors, (state->num_errors + 1) * sizeof(app_error_t));
+    state->num_dropped_errors++;
+  }
+  portEXIT_CRITICAL(&lock);
+
+  if (!recorded) {
+    ESP_LOGE(TAG, "Error %d: %s (not recorded, too many errors)", code,
+             message);
   }
-  state->errors[state->num_errors] = error;
-  state->num_errors++;
 }
 
 void app_free_state(app_state_t *state) {
-  free_errors(state);
-  free(state->bus_handles);
 #ifndef CONFIG_ESP_SCANNER_MODE
-  free(state->device_handles);
-  free(state->sensor_handles);
-  free_onewire_config(&state->onewire_config);
-  free_mqtt_config(&state->mqtt_config);
-
-  if (state->sensor_readings != NULL) {
-    free(state->sensor_readings);
+  for (int i = 0; i < state->num_sensors; i++) {
+    state->devices.ready[i] = false;
   }
 #endif
+  for (int i = 0; i < state->num_buses; i++) {
+    if (state->bus_handles[i] != NULL) {
+      onewire_bus_del(state->bus_handles[i]);
+      state->bus_handles[i] = NULL;
+    }
+  }
+  state->num_buses = 0;
 }
\ No newline at end of file
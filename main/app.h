@@ -1,10 +1,28 @@
 #ifndef APP_H
 #define APP_H
 
+#include "adaptive.h"
 #include "app_types.h"
+#include "backlog.h"
+#include "command.h"
 #include "config.h"
+#include "discovery.h"
+#include "health.h"
+#include "homeassistant.h"
 #include "mqtt.h"
+#include "oversampling.h"
+#include "pacing.h"
+#include "payload.h"
+#include "pipeline.h"
+#include "power.h"
+#include "resolution.h"
+#include "scanner.h"
+#include "scheduler.h"
 #include "sensor.h"
+#include "sensor_stats.h"
+#include "supervisor.h"
+#include "telemetry.h"
+#include "topics.h"
 #include "utils.h"
 #include "wifi.h"
 
@@ -41,6 +59,19 @@ void app_run(app_state_t *state);
  */
 void app_deinit(app_state_t *state);
 
+/**
+ * @brief Handles a wake cycle that exceeded its budget
+ *
+ * This function is called by the cycle supervisor when a budget expires. It
+ * keeps the readings taken so far in the backlog and forces deep sleep, even
+ * when sleep mode is disabled.
+ *
+ * @param phase The phase that exceeded its budget
+ * @param arg A pointer to the application state
+ * @return void
+ */
+void app_handle_overrun(supervisor_phase_t phase, void *arg);
+
 /**
  * @brief Appends an error to the application state
  *
@@ -96,10 +127,26 @@ void init_onewire_buses(app_state_t *state);
 void calculate_num_sensors(app_state_t *state);
 
 /**
- * @brief Reads the sensors and appends the readings to the application state
+ * @brief Creates the sensor handle pool
+ *
+ * This function flattens the configuration into the device table and
+ * applies the resolution of every sensor, once, right after the buses are
+ * initialized. Sensors are indexed by the flat sensor id (the position of
+ * the sensor in the configuration, across buses) and sensors of a bus are
+ * contiguous. With bus multiplexing each bus is attached only while its
+ * sensors are set up.
+ *
+ * @param state A pointer to the application state
+ * @return void
+ */
+void init_sensor_pool(app_state_t *state);
+
+/**
+ * @brief Reads the sensors and stores the readings in the application state
  *
- * This function reads the sensors and appends the readings to the application
- * state.
+ * This function walks the device table one bus at a time and stores each
+ * reading at the sensor's flat id. With bus multiplexing each bus is
+ * attached for its slot only. It does not allocate memory.
  *
  * @param state A pointer to the application state
  * @return void
@@ -109,13 +156,43 @@ void read_sensors(app_state_t *state);
 /**
  * @brief Publishes the sensor readings to the MQTT broker
  *
- * This function publishes the sensor readings to the MQTT broker.
+ * This function publishes the sensor readings to the MQTT broker. Readings
+ * kept in the backlog are published first. When no broker can be reached,
+ * the readings are moved to the backlog instead.
  *
  * @param state A pointer to the application state
  * @return void
  */
 void publish_sensor_readings(app_state_t *state);
 
+/**
+ * @brief Keeps the sensor readings for a later cycle
+ *
+ * This function moves the sensor readings to the RTC backlog, so they are
+ * published once the brokers can be reached again.
+ *
+ * @param state A pointer to the application state
+ * @return void
+ */
+void store_sensor_readings(app_state_t *state);
+
+#ifdef CONFIG_ESP_PIPELINE
+/**
+ * @brief Reads the sensors and publishes the readings in parallel
+ *
+ * This function reads the sensors in a task pinned to the second core while
+ * the calling task, on the core of the WiFi stack, connects to the brokers.
+ * Each reading is handed over through a lock-free ring and published as
+ * soon as its scratchpad is read. The telemetry is published once the
+ * acquisition is over. When no broker can be reached, the readings are
+ * moved to the backlog instead.
+ *
+ * @param state A pointer to the application state
+ * @return void
+ */
+void run_pipeline(app_state_t *state);
+#endif
+
 /**
  * @brief Logs errors to the console
  *
@@ -139,16 +216,18 @@ void log_runtime(app_state_t *state);
 /**
  * @brief Enters sleep mode
  *
- * This function enters sleep mode.
+ * This function enters sleep mode until the earliest sensor deadline.
  *
+ * @param state A pointer to the application state
  * @return void
  */
-void enter_sleep_mode();
+void enter_sleep_mode(app_state_t *state);
 
 /**
- * @brief Frees memory allocated for the application state
+ * @brief Releases the driver resources held by the application state
  *
- * This function frees memory allocated for the application state.
+ * This function releases the sensor devices and the 1-Wire buses. The state
+ * itself is statically allocated and is not freed.
  *
  * @param state A pointer to the application state
  * @return void
@@ -156,13 +235,14 @@ void enter_sleep_mode();
 void app_free_state(app_state_t *state);
 
 /**
- * @brief Frees memory allocated for the errors
+ * @brief Resets the per-cycle part of the application state
  *
- * This function frees memory allocated for the errors.
+ * This function clears the errors and marks every reading as not taken. It
+ * is called once at the start of each cycle.
  *
  * @param state A pointer to the application state
  * @return void
  */
-void free_errors(app_state_t *state);
+void app_reset_cycle(app_state_t *state);
 
 #endif // APP_H
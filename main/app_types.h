@@ -10,31 +10,43 @@
 #include "onewire_device.h"
 
 #ifndef CONFIG_ESP_SCANNER_MODE
-#include "ds18b20.h"
+#include "mqtt.h"
 #include "sensor_types.h"
 #endif // CONFIG_ESP_SCANNER_MODE
 
+#define MAX_PAYLOAD_LENGTH 256 ///< Maximum length of a reading payload
+
 typedef struct {
   int code;
   const char *message;
 } app_error_t;
 
+/**
+ * @brief The application state.
+ *
+ * Every array has a capacity fixed at build time by Kconfig, so the state is
+ * allocated once, statically, and the wake cycle does not allocate memory
+ * outside the IDF drivers.
+ */
 typedef struct {
 #ifdef CONFIG_ESP_DEBUG_MODE
   struct timespec start_time;
 #endif // CONFIG_ESP_DEBUG_MODE
   bool running;
-  app_error_t *errors;
-  uint8_t num_errors;
+  app_error_t errors[CONFIG_ESP_MAX_ERRORS];
+  uint16_t num_errors;
+  uint16_t num_dropped_errors; ///< Errors not recorded, `errors` being full
   onewire_config_t onewire_config;
-  onewire_bus_handle_t *bus_handles;
-  uint8_t num_buses;
+  onewire_bus_handle_t bus_handles[CONFIG_ESP_MAX_BUSES]; ///< NULL if detached
+  uint16_t num_buses;
 #ifndef CONFIG_ESP_SCANNER_MODE
-  sensor_reading_t *sensor_readings;
-  onewire_device_t *device_handles;
-  ds18b20_device_handle_t *sensor_handles;
-  uint8_t num_sensors;
+  sensor_reading_t sensor_readings[CONFIG_ESP_MAX_SENSORS];
+  device_table_t devices; ///< The sensors, in reading order
+  uint16_t num_sensors;
   mqtt_config_t mqtt_config;
+#if defined(CONFIG_ESP_LIGHT_SLEEP) || defined(CONFIG_ESP_PIPELINE)
+  MQTT_Client mqtt_clients[CONFIG_ESP_MAX_BROKERS]; ///< Open at the same time
+#endif
 #endif // CONFIG_ESP_SCANNER_MODE
 
 } app_state_t;
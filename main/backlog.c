@@ -0,0 +1,62 @@
+#include "backlog.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+static const char *TAG = "backlog";
+
+RTC_DATA_ATTR static backlog_entry_t s_entries[CONFIG_ESP_BACKLOG_SIZE];
+RTC_DATA_ATTR static int s_head = 0; // Position of the oldest entry
+RTC_DATA_ATTR static int s_count = 0;
+
+bool backlog_push(uint16_t sensor, const sensor_reading_t *reading) {
+  int tail = (s_head + s_count) % CONFIG_ESP_BACKLOG_SIZE;
+
+  s_entries[tail] = (backlog_entry_t){
+      .sensor = sensor,
+      .reading = *reading,
+      .timestamp = time(NULL),
+  };
+
+  if (s_count < CONFIG_ESP_BACKLOG_SIZE) {
+    s_count++;
+    return true;
+  }
+
+  // Full, the oldest reading has just been overwritten
+  s_head = (s_head + 1) % CONFIG_ESP_BACKLOG_SIZE;
+  ESP_LOGW(TAG, "Backlog full, dropped the oldest reading");
+  return false;
+}
+
+int backlog_count(void) { return s_count; }
+
+const backlog_entry_t *backlog_get(int i) {
+  if (i < 0 || i >= s_count) {
+    return NULL;
+  }
+  return &s_entries[(s_head + i) % CONFIG_ESP_BACKLOG_SIZE];
+}
+
+void backlog_keep(const bool *keep) {
+  int kept = 0;
+
+  // Moves each kept entry down, over the dropped ones before it
+  for (int i = 0; i < s_count; i++) {
+    if (keep[i]) {
+      s_entries[(s_head + kept) % CONFIG_ESP_BACKLOG_SIZE] =
+          s_entries[(s_head + i) % CONFIG_ESP_BACKLOG_SIZE];
+      kept++;
+    }
+  }
+  s_count = kept;
+}
+
+void backlog_clear(void) {
+  s_head = 0;
+  s_count = 0;
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,66 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief A sensor reading that could not be published when it was taken.
+ */
+typedef struct {
+  uint16_t sensor;          ///< Flat index of the sensor in the configuration
+  sensor_reading_t reading; ///< The reading itself
+  time_t timestamp;         ///< When the reading was taken (RTC wall clock)
+} backlog_entry_t;
+
+/**
+ * @brief Stores a reading in the RTC backlog.
+ *
+ * The backlog survives deep sleep. When it is full, the oldest entry is
+ * overwritten.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param reading The reading to store.
+ * @return true if it was stored without dropping an older one.
+ */
+bool backlog_push(uint16_t sensor, const sensor_reading_t *reading);
+
+/**
+ * @brief Returns the number of readings in the backlog.
+ *
+ * @return int The number of stored readings.
+ */
+int backlog_count(void);
+
+/**
+ * @brief Returns a stored reading, oldest first.
+ *
+ * @param i Position of the reading, between 0 and `backlog_count() - 1`.
+ * @return const backlog_entry_t* The stored reading.
+ */
+const backlog_entry_t *backlog_get(int i);
+
+/**
+ * @brief Drops the readings of the backlog that are not flagged, keeping the
+ * others in order.
+ *
+ * @param keep One flag per reading, indexed like `backlog_get()`.
+ * @return void
+ */
+void backlog_keep(const bool *keep);
+
+/**
+ * @brief Drops every reading from the backlog.
+ *
+ * @return void
+ */
+void backlog_clear(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // BACKLOG_H
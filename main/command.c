@@ -0,0 +1,193 @@
+#include "command.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "config_types.h"
+#include "sensor_types.h"
+#include "telemetry.h"
+
+static const char *TAG = "command";
+
+SENSOR_STATE_ATTR static command_override_t s_overrides[CONFIG_ESP_MAX_SENSORS];
+
+static bool commands_enabled(void) {
+  return strlen(CONFIG_ESP_MQTT_COMMAND_TOPIC) > 0;
+}
+
+static const char *fleet_topic(void) {
+  static char topic[MAX_MQTT_TOPIC_LENGTH] = "";
+
+  if (topic[0] == '\0') {
+    snprintf(topic, sizeof(topic), "%s/%s", CONFIG_ESP_MQTT_COMMAND_TOPIC,
+             COMMAND_FLEET_SUFFIX);
+  }
+  return topic;
+}
+
+const char *command_topic(void) {
+  static char topic[MAX_MQTT_TOPIC_LENGTH] = "";
+
+  if (commands_enabled() && topic[0] == '\0') {
+    snprintf(topic, sizeof(topic), "%s/%s", CONFIG_ESP_MQTT_COMMAND_TOPIC,
+             telemetry_device_id());
+  }
+  return topic;
+}
+
+QueueHandle_t command_queue_create(void) {
+  if (!commands_enabled()) {
+    return NULL;
+  }
+  return xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(command_t));
+}
+
+void command_subscribe(esp_mqtt_client_handle_t client) {
+  if (!commands_enabled()) {
+    return;
+  }
+
+  esp_mqtt_client_subscribe(client, command_topic(), 1);
+  esp_mqtt_client_subscribe(client, fleet_topic(), 1);
+  ESP_LOGI(TAG, "Listening for commands on %s and %s", command_topic(),
+           fleet_topic());
+}
+
+static bool topic_is(const esp_mqtt_event_t *event, const char *topic) {
+  return event->topic_len == (int)strlen(topic) &&
+         strncmp(event->topic, topic, event->topic_len) == 0;
+}
+
+/**
+ * Parses the text of a command. The optional target keeps its default of -1
+ * when missing.
+ */
+static bool parse_command(const char *text, command_t *command) {
+  char name[16];
+  int value = 0;
+  int target = -1;
+
+  if (sscanf(text, "%15s", name) != 1) {
+    return false;
+  }
+
+  // The period is kept as a uint16_t, see command_override_t
+  if (strcmp(name, "interval") == 0 &&
+      sscanf(text, "%*s %d %d", &value, &target) >= 1 && value > 0 &&
+      value <= UINT16_MAX) {
+    command->type = COMMAND_INTERVAL;
+  } else if (strcmp(name, "resolution") == 0 &&
+             sscanf(text, "%*s %d %d", &value, &target) >= 1 && value >= 9 &&
+             value <= 12) {
+    command->type = COMMAND_RESOLUTION;
+  } else if (strcmp(name, "read") == 0) {
+    command->type = COMMAND_READ;
+  } else if (strcmp(name, "rediscover") == 0) {
+    sscanf(text, "%*s %d", &target);
+    command->type = COMMAND_REDISCOVER;
+  } else if (strcmp(name, "stats") == 0) {
+    command->type = COMMAND_STATS;
+  } else {
+    return false;
+  }
+
+  command->value = value;
+  command->target = target;
+  return true;
+}
+
+/**
+ * Tells whether a command changes a setting, which can be applied again at
+ * every wake, rather than do something once.
+ */
+static bool is_setting(const command_t *command) {
+  return command->type == COMMAND_INTERVAL ||
+         command->type == COMMAND_RESOLUTION;
+}
+
+void command_receive(QueueHandle_t queue, const esp_mqtt_event_t *event) {
+  bool fleet = topic_is(event, fleet_topic());
+  if (queue == NULL || (!fleet && !topic_is(event, command_topic()))) {
+    return;
+  }
+
+  // Clearing a retained command delivers it again, empty
+  if (event->data_len <= 0 || event->data_len >= COMMAND_MAX_LENGTH) {
+    return;
+  }
+
+  char text[COMMAND_MAX_LENGTH];
+  memcpy(text, event->data, event->data_len);
+  text[event->data_len] = '\0';
+
+  command_t command = {
+      .retained = event->retain,
+      .fleet = fleet,
+      .client = event->client,
+  };
+  if (!parse_command(text, &command)) {
+    ESP_LOGW(TAG, "Ignoring invalid command \"%s\"", text);
+    return;
+  }
+  if (command.retained && command.fleet && !is_setting(&command)) {
+    // Devices do not clear the fleet topic, it would run at every wake
+    ESP_LOGW(TAG, "Ignoring retained fleet command \"%s\"", text);
+    return;
+  }
+
+  ESP_LOGI(TAG, "Received %scommand \"%s\"",
+           command.retained ? "retained " : "", text);
+  if (xQueueSend(queue, &command, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Command queue full, dropping \"%s\"", text);
+  }
+}
+
+bool command_next(QueueHandle_t queue, command_t *command, TickType_t wait) {
+  return queue != NULL && xQueueReceive(queue, command, wait) == pdTRUE;
+}
+
+void command_clear_retained(MQTT_Client *mqtt_client,
+                            const command_t *command) {
+  if (!command->retained || command->fleet) {
+    return;
+  }
+  mqtt_publish_retained(mqtt_client, command_topic(), "");
+}
+
+void command_set_override(uint64_t rom, int period, int resolution) {
+  command_override_t *slot = NULL;
+
+  for (int i = 0; i < CONFIG_ESP_MAX_SENSORS; i++) {
+    if (s_overrides[i].rom == rom) {
+      slot = &s_overrides[i];
+      break;
+    }
+    if (slot == NULL && s_overrides[i].rom == 0) {
+      slot = &s_overrides[i];
+    }
+  }
+
+  if (slot == NULL) {
+    ESP_LOGW(TAG, "No room left to keep the settings of %016llX", rom);
+    return;
+  }
+
+  slot->rom = rom;
+  if (period > 0) {
+    slot->period = period;
+  }
+  if (resolution > 0) {
+    slot->resolution = resolution;
+  }
+}
+
+const command_override_t *command_get_override(uint64_t rom) {
+  for (int i = 0; i < CONFIG_ESP_MAX_SENSORS; i++) {
+    if (rom != 0 && s_overrides[i].rom == rom) {
+      return &s_overrides[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,134 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "mqtt.h"
+#include "mqtt_client.h"
+#include "sdkconfig.h"
+
+#define COMMAND_MAX_LENGTH 64      ///< Longest accepted command text
+#define COMMAND_QUEUE_LENGTH 8     ///< Commands waiting to be applied
+#define COMMAND_FLEET_SUFFIX "all" ///< Topic shared by every device
+
+/**
+ * @brief The commands accepted on the command topics.
+ */
+typedef enum {
+  COMMAND_INTERVAL,   ///< "interval <1-65535> [idx]": period in seconds
+  COMMAND_RESOLUTION, ///< "resolution <bits> [idx]": sensor resolution
+  COMMAND_READ,       ///< "read": read every sensor at once
+  COMMAND_REDISCOVER, ///< "rediscover [bus]": search the buses again
+  COMMAND_STATS,      ///< "stats": publish the sensor statistics now
+} command_type_t;
+
+/**
+ * @brief A parsed command.
+ */
+typedef struct {
+  command_type_t type;
+  int value;     ///< Seconds or bits, unused by the other commands
+  int target;    ///< Sensor idx or bus position, -1 for all
+  bool retained; ///< Delivered as a retained message
+  bool fleet;    ///< Received on the fleet topic rather than the device topic
+  esp_mqtt_client_handle_t client; ///< Client the command was received on
+} command_t;
+
+/**
+ * @brief Setting overrides received by command, kept across deep sleep.
+ *
+ * Zero fields keep the configured value.
+ */
+typedef struct __attribute__((packed)) {
+  uint64_t rom;       ///< ROM code of the sensor
+  uint16_t period;    ///< Sampling period, in seconds
+  uint8_t resolution; ///< Resolution, in bits
+} command_override_t;
+
+/**
+ * @brief Returns the command topic of this device,
+ * `<CONFIG_ESP_MQTT_COMMAND_TOPIC>/<device id>`.
+ *
+ * @return const char* The topic, empty when commands are disabled.
+ */
+const char *command_topic(void);
+
+/**
+ * @brief Creates the queue a client receives its commands in.
+ *
+ * @return QueueHandle_t The queue, NULL when commands are disabled or on
+ * allocation failure.
+ */
+QueueHandle_t command_queue_create(void);
+
+/**
+ * @brief Subscribes a freshly connected client to the device and fleet
+ * command topics.
+ *
+ * The broker delivers the retained commands right after, so a device that
+ * slept meanwhile still picks them up. Does nothing when
+ * `CONFIG_ESP_MQTT_COMMAND_TOPIC` is empty.
+ *
+ * @param client The connected client.
+ * @return void
+ */
+void command_subscribe(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Parses a message received on a command topic and queues it.
+ *
+ * Called from the MQTT task. Messages on other topics, empty messages and
+ * invalid commands are dropped, as are commands that find the queue full.
+ *
+ * @param queue The queue of the client, NULL to drop every command.
+ * @param event The MQTT_EVENT_DATA event.
+ * @return void
+ */
+void command_receive(QueueHandle_t queue, const esp_mqtt_event_t *event);
+
+/**
+ * @brief Takes the oldest queued command.
+ *
+ * @param queue The queue of the client.
+ * @param command Where to copy the command.
+ * @param wait How long to wait for a command, in ticks.
+ * @return true if a command was taken.
+ */
+bool command_next(QueueHandle_t queue, command_t *command, TickType_t wait);
+
+/**
+ * @brief Clears a retained command from the device topic, so it is not
+ * applied again at the next wake.
+ *
+ * Commands received on the fleet topic are left alone, the other devices
+ * still need them.
+ *
+ * @param mqtt_client The client the command was received on.
+ * @param command The applied command.
+ * @return void
+ */
+void command_clear_retained(MQTT_Client *mqtt_client,
+                            const command_t *command);
+
+/**
+ * @brief Records a sampling period or resolution override for a sensor.
+ *
+ * @param rom ROM code of the sensor.
+ * @param period Sampling period in seconds, 0 to leave it unchanged.
+ * @param resolution Resolution in bits, 0 to leave it unchanged.
+ * @return void
+ */
+void command_set_override(uint64_t rom, int period, int resolution);
+
+/**
+ * @brief Returns the overrides of a sensor.
+ *
+ * @param rom ROM code of the sensor.
+ * @return const command_override_t* The overrides, NULL if there is none.
+ */
+const command_override_t *command_get_override(uint64_t rom);
+
+#endif // COMMAND_H
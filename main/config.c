@@ -9,128 +9,64 @@
 
 static const char *TAG = "snow_config";
 
-sensor_config_t *create_sensor_config(const char *address, int idx,
-                                      int resolution) {
-  if (address == NULL || idx < 0 || resolution < 0) {
-    fprintf(stderr, "Invalid input parameters for create_sensor_config\n");
-    return NULL;
-  }
-
-  sensor_config_t *sensor = (sensor_config_t *)malloc(sizeof(sensor_config_t));
-  if (sensor == NULL) {
-    fprintf(stderr, "Memory allocation failed for create_sensor_config\n");
-    return NULL;
-  }
-
-  // Copy the address
-  strncpy(sensor->address, address, MAX_SENSOR_ADDRESS_LENGTH - 1);
-  sensor->address[MAX_SENSOR_ADDRESS_LENGTH - 1] = '\0';
-
-  sensor->idx = idx;
-  sensor->resolution = resolution;
+void reset_onewire_config(onewire_config_t *config) {
+  if (!config)
+    return;
 
-  return sensor;
+  config->bus_count = 0;
+  config->sensor_count = 0;
 }
 
-bus_config_t *create_bus_config(int pin) {
-  if (pin < 0) {
-    fprintf(stderr, "Invalid input parameter for create_bus_config\n");
+bus_config_t *add_bus_config(onewire_config_t *config, int pin) {
+  if (!config || pin < 0) {
+    fprintf(stderr, "Invalid input parameters for add_bus_config\n");
     return NULL;
   }
 
-  bus_config_t *bus = (bus_config_t *)malloc(sizeof(bus_config_t));
-  if (bus == NULL) {
-    fprintf(stderr, "Memory allocation failed for create_bus_config\n");
+  if (config->bus_count >= CONFIG_ESP_MAX_BUSES) {
+    ESP_LOGE(TAG, "Too many buses, at most %d are supported",
+             CONFIG_ESP_MAX_BUSES);
     return NULL;
   }
 
+  bus_config_t *bus = &config->buses[config->bus_count++];
   bus->pin = pin;
-  bus->sensors = NULL; // Initialize to NULL
+  // Sensors of this bus follow the ones of the previous buses
+  bus->sensors = &config->sensors[config->sensor_count];
   bus->sensor_count = 0;
-  bus->sensor_capacity = 0;
 
   return bus;
 }
 
-void add_sensor_config_to_bus_config(bus_config_t *bus,
-                                     sensor_config_t *sensor) {
-  if (!bus || !sensor)
-    return;
-
-  if (bus->sensor_count >= bus->sensor_capacity) {
-    int new_capacity =
-        (bus->sensor_capacity == 0) ? 1 : bus->sensor_capacity * 2;
-    sensor_config_t **new_sensors = (sensor_config_t **)realloc(
-        bus->sensors, new_capacity * sizeof(sensor_config_t *));
-    if (!new_sensors)
-      return; // Failed to reallocate memory, return without adding the sensor
-    bus->sensors = new_sensors;
-    bus->sensor_capacity = new_capacity;
-  }
-
-  bus->sensors[bus->sensor_count++] = sensor;
-}
-
-void free_sensor_config(sensor_config_t *sensor) {
-  if (sensor)
-    free(sensor);
-}
-
-void free_bus_config(bus_config_t *bus) {
-  if (!bus)
-    return;
-
-  for (int i = 0; i < bus->sensor_count; ++i) {
-    free_sensor_config(bus->sensors[i]);
+sensor_config_t *add_sensor_config(onewire_config_t *config,
+                                   uint64_t address, int idx, int resolution,
+                                   int period) {
+  if (!config || config->bus_count == 0 || address == 0 || idx < 0 ||
+      resolution < 9 || resolution > 12 || period < 0) {
+    fprintf(stderr, "Invalid input parameters for add_sensor_config\n");
+    return NULL;
   }
-  free(bus->sensors);
-  free(bus);
-}
 
-onewire_config_t *create_onewire_config() {
-  onewire_config_t *config =
-      (onewire_config_t *)malloc(sizeof(onewire_config_t));
-  if (config == NULL) {
-    fprintf(stderr, "Memory allocation failed for create_onewire_config\n");
+  if (config->sensor_count >= CONFIG_ESP_MAX_SENSORS) {
+    ESP_LOGE(TAG, "Too many sensors, at most %d are supported",
+             CONFIG_ESP_MAX_SENSORS);
     return NULL;
   }
 
-  config->buses = NULL; // Initialize to NULL
-  config->bus_count = 0;
-  config->bus_capacity = 0;
+  sensor_config_t *sensor = &config->sensors[config->sensor_count++];
 
-  return config;
-}
-
-void add_bus_to_onewire_config(onewire_config_t *config, bus_config_t *bus) {
-  if (!config || !bus)
-    return;
-
-  if (config->bus_count >= config->bus_capacity) {
-    int new_capacity =
-        (config->bus_capacity == 0) ? 1 : config->bus_capacity * 2;
-    bus_config_t **new_buses = (bus_config_t **)realloc(
-        config->buses, new_capacity * sizeof(bus_config_t *));
-    if (!new_buses)
-      return; // Failed to reallocate memory, return without adding the bus
-    config->buses = new_buses;
-    config->bus_capacity = new_capacity;
-  }
-
-  config->buses[config->bus_count++] = bus;
-}
+  sensor->address = address;
+  sensor->idx = idx;
+  sensor->resolution = resolution;
+  sensor->period = period > 0 ? period : CONFIG_ESP_SLEEP_DURATION;
 
-void free_onewire_config(onewire_config_t *config) {
-  if (!config)
-    return;
+  config->buses[config->bus_count - 1].sensor_count++;
 
-  for (int i = 0; i < config->bus_count; ++i) {
-    free_bus_config(config->buses[i]);
-  }
-  free(config->buses);
+  return sensor;
 }
 
-static bus_config_t *parse_bus_config(const char **ptr) {
+static bus_config_t *parse_bus_config(const char **ptr,
+                                      onewire_config_t *config) {
 
   ESP_LOGD(TAG, "[parse_bus_config] input: %s", *ptr);
 
@@ -147,8 +83,8 @@ static bus_config_t *parse_bus_config(const char **ptr) {
   }
   (*ptr)++; // Move past ':'
 
-  // Create a new bus configuration
-  bus_config_t *bus = create_bus_config(pin);
+  // Add a new bus configuration
+  bus_config_t *bus = add_bus_config(config, pin);
   if (!bus) {
     return NULL;
   }
@@ -158,17 +94,22 @@ static bus_config_t *parse_bus_config(const char **ptr) {
   return bus;
 }
 
-static void parse_sensor_configs(const char **ptr, bus_config_t *bus) {
+static int parse_sensor_configs(const char **ptr, onewire_config_t *config) {
   ESP_LOGD(TAG, "[parse_sensor_configs] input: %s", *ptr);
 
+  bus_config_t *bus = &config->buses[config->bus_count - 1];
+
   while (**ptr != ';' && **ptr != '\0') {
     skip_whitespace(ptr); // Skip any leading whitespace
 
     char address[MAX_SENSOR_ADDRESS_LENGTH];
     int idx;
     int resolution;
+    int period = 0; // The period is optional
 
-    if (sscanf(*ptr, "%17[^,],%d,%d|", address, &idx, &resolution) != 3) {
+    int fields = sscanf(*ptr, "%17[^,],%d,%d,%d", address, &idx, &resolution,
+                        &period);
+    if (fields != 3 && fields != 4) {
       // Failed to parse sensor, skip this sensor
       while (**ptr != '|' && **ptr != ';' && **ptr != '\0') {
         (*ptr)++;
@@ -179,9 +120,14 @@ static void parse_sensor_configs(const char **ptr, bus_config_t *bus) {
       continue;
     }
 
-    sensor_config_t *sensor = create_sensor_config(address, idx, resolution);
-    if (sensor) {
-      add_sensor_config_to_bus_config(bus, sensor);
+    // Parsed once here, the wake cycle only deals with ROM codes
+    char *end;
+    uint64_t rom = strtoull(address, &end, 16);
+    if (end == address || *end != '\0') {
+      ESP_LOGE(TAG, "Invalid sensor address: %s", address);
+    } else if (add_sensor_config(config, rom, idx, resolution, period) ==
+               NULL) {
+      return -1;
     }
 
     // Move to the next sensor
@@ -195,24 +141,27 @@ static void parse_sensor_configs(const char **ptr, bus_config_t *bus) {
 
   ESP_LOGD(TAG, "[parse_sensor_configs] parsed %d sensors for bus %d",
            bus->sensor_count, bus->pin);
+
+  return bus->sensor_count;
 }
 
-onewire_config_t *parse_onewire_config(const char *config_str) {
-  if (!config_str)
-    return NULL;
+int parse_onewire_config(const char *config_str, onewire_config_t *config) {
+  if (!config_str || !config)
+    return -1;
 
   ESP_LOGD(TAG, "[parse_onewire_config] input: %s", config_str);
 
-  onewire_config_t *config = create_onewire_config();
-  if (!config)
-    return NULL;
+  reset_onewire_config(config);
 
   const char *ptr = config_str;
 
   // Iterate over each bus configuration
   while (*ptr != '\0') {
-    bus_config_t *bus = parse_bus_config(&ptr);
+    bus_config_t *bus = parse_bus_config(&ptr, config);
     if (!bus) {
+      if (config->bus_count >= CONFIG_ESP_MAX_BUSES) {
+        return -1;
+      }
       continue;
     }
 
@@ -221,15 +170,15 @@ onewire_config_t *parse_onewire_config(const char *config_str) {
       ptr++;
     }
     if (*ptr == '\0') {
-      free_onewire_config(config);
-      return NULL;
+      reset_onewire_config(config);
+      return -1;
     }
     ptr++; // Move past ':'
 
-    parse_sensor_configs(&ptr, bus);
-
-    // Add the bus to the configuration
-    add_bus_to_onewire_config(config, bus);
+    if (parse_sensor_configs(&ptr, config) < 0) {
+      reset_onewire_config(config);
+      return -1;
+    }
 
     // Move to the next bus or end of string
     while (*ptr != ';' && *ptr != '\0') {
@@ -242,12 +191,22 @@ onewire_config_t *parse_onewire_config(const char *config_str) {
 
   ESP_LOGD(TAG, "[parse_onewire_config] parsed %d buses", config->bus_count);
 
-  return config;
+  return config->bus_count;
 }
 
 #define MQTT_DEFAULT_PORT 1883
 #define MQTT_DEFAULT_TLS_PORT 8883
 
+static void copy_field(char *dest, size_t dest_len, const char *src,
+                       const char *name) {
+  if (strlen(src) >= dest_len) {
+    ESP_LOGW(TAG, "MQTT %s truncated to %d characters", name,
+             (int)dest_len - 1);
+  }
+  strncpy(dest, src, dest_len - 1);
+  dest[dest_len - 1] = '\0';
+}
+
 void parse_mqtt_broker_connection_string(const char *connection_string,
                                          mqtt_broker_config_t *config) {
   assert(connection_string != NULL && config != NULL);
@@ -256,32 +215,35 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
            connection_string);
 
   // Set default values
-  config->protocol = NULL;
-  config->host = NULL;
+  config->protocol[0] = '\0';
+  config->host[0] = '\0';
   config->port = -1; // Use -1 to indicate invalid port
-  config->username = NULL;
-  config->password = NULL;
-  config->client_id = NULL;
-  config->topic = NULL;
+  config->username[0] = '\0';
+  config->password[0] = '\0';
+  config->client_id[0] = '\0';
+  config->topic[0] = '\0';
+  config->format = MQTT_PAYLOAD_JSON;
+  config->retain = false;
 
   // Copy the connection string to avoid modifying the original
-  char *conn_copy = strdup(connection_string);
-  if (conn_copy == NULL) {
-    // Memory allocation failed
+  char conn_copy[MAX_MQTT_CONNECTION_STRING_LENGTH];
+  if (strlen(connection_string) >= sizeof(conn_copy)) {
+    ESP_LOGE(TAG, "Connection string too long: %s", connection_string);
     return;
   }
+  strcpy(conn_copy, connection_string);
 
   // Check if the connection string starts with "mqtt(s)://"
   char *protocol = strtok(conn_copy, ":/");
   if (protocol != NULL &&
       (strcmp(protocol, "mqtt") == 0 || strcmp(protocol, "mqtts") == 0)) {
-    config->protocol = strdup(protocol);
+    copy_field(config->protocol, sizeof(config->protocol), protocol,
+               "protocol");
     ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] protocol: %s",
              config->protocol);
   } else {
     ESP_LOGE(TAG, "Invalid protocol in connection string: %s",
              connection_string);
-    free(conn_copy);
     return;
   }
 
@@ -295,8 +257,10 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
     char *colon = strchr(ptr, ':');
     if (colon != NULL) {
       *colon = '\0';
-      config->username = strdup(ptr);
-      config->password = strdup(colon + 1);
+      copy_field(config->username, sizeof(config->username), ptr,
+                 "username");
+      copy_field(config->password, sizeof(config->password), colon + 1,
+                 "password");
 
       ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] username: %s",
                config->username);
@@ -310,13 +274,12 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
   char *slash = strchr(ptr, '/');
   if (slash != NULL) {
     *slash = '\0';
-    config->host = strdup(ptr);
+    copy_field(config->host, sizeof(config->host), ptr, "host");
     ptr = slash + 1;
     ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] host: %s",
              config->host);
   } else {
     ESP_LOGE(TAG, "Invalid connection string: %s", connection_string);
-    free(conn_copy);
     return;
   }
 
@@ -342,28 +305,50 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
   char *question = strchr(ptr, '?');
   if (question != NULL) {
     *question = '\0';
-    config->client_id = strdup(ptr);
+    copy_field(config->client_id, sizeof(config->client_id), ptr,
+               "client ID");
     ptr = question + 1;
     ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] client_id: %s",
              config->client_id);
   } else {
-    config->client_id = strdup(ptr);
+    copy_field(config->client_id, sizeof(config->client_id), ptr,
+               "client ID");
     ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] client_id: %s",
              config->client_id);
-    free(conn_copy);
     return;
   }
 
-  // Check if there's a topic
-  char *topic_prefix = "topic=";
-  char *topic_ptr = strstr(ptr, topic_prefix);
-  if (topic_ptr != NULL) {
-    config->topic = strdup(topic_ptr + strlen(topic_prefix));
-    ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] topic: %s",
-             config->topic);
-  }
+  // Parse the query parameters, separated by '&'
+  while (ptr != NULL && *ptr != '\0') {
+    char *ampersand = strchr(ptr, '&');
+    if (ampersand != NULL) {
+      *ampersand = '\0';
+    }
 
-  free(conn_copy);
+    if (strncmp(ptr, "topic=", strlen("topic=")) == 0) {
+      copy_field(config->topic, sizeof(config->topic),
+                 ptr + strlen("topic="), "topic");
+      ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] topic: %s",
+               config->topic);
+    } else if (strcmp(ptr, "format=json") == 0) {
+      config->format = MQTT_PAYLOAD_JSON;
+      ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] format: json");
+    } else if (strcmp(ptr, "format=cbor") == 0) {
+      config->format = MQTT_PAYLOAD_CBOR;
+      ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] format: cbor");
+    } else if (strcmp(ptr, "retain=true") == 0 ||
+               strcmp(ptr, "retain=1") == 0) {
+      config->retain = true;
+      ESP_LOGD(TAG, "[parse_mqtt_broker_connection_string] retain: true");
+    } else if (strcmp(ptr, "retain=false") == 0 ||
+               strcmp(ptr, "retain=0") == 0) {
+      config->retain = false;
+    } else {
+      ESP_LOGW(TAG, "Ignoring unknown connection parameter: %s", ptr);
+    }
+
+    ptr = ampersand != NULL ? ampersand + 1 : NULL;
+  }
 }
 
 void parse_mqtt_connection_string(const char *connection_string,
@@ -373,6 +358,8 @@ void parse_mqtt_connection_string(const char *connection_string,
 
   ESP_LOGD(TAG, "[parse_mqtt_connection_string] input: %s", connection_string);
 
+  mqtt_config->broker_count = 0;
+
   const char *ptr = connection_string;
   while (*ptr != '\0') {
 
@@ -382,74 +369,32 @@ void parse_mqtt_connection_string(const char *connection_string,
       end++;
     }
 
-    // Create a temporary copy of the current broker connection string
-    char *temp = strndup(ptr, end - ptr);
-    if (!temp) {
-      return;
+    if (mqtt_config->broker_count >= CONFIG_ESP_MAX_BROKERS) {
+      ESP_LOGE(TAG, "Too many brokers, at most %d are supported",
+               CONFIG_ESP_MAX_BROKERS);
+      break;
     }
 
-    // Parse the current broker connection string
-    mqtt_broker_config_t config;
-    parse_mqtt_broker_connection_string(temp, &config);
-
-    // Add the parsed broker to the mqtt_config
-    if (mqtt_config->broker_count >= mqtt_config->broker_capacity) {
-      int new_capacity = (mqtt_config->broker_capacity == 0)
-                             ? 1
-                             : mqtt_config->broker_capacity * 2;
-      mqtt_broker_config_t *new_brokers = (mqtt_broker_config_t *)realloc(
-          mqtt_config->brokers, new_capacity * sizeof(mqtt_broker_config_t));
-      if (!new_brokers) {
-        free(temp);
-        return; // Failed to reallocate memory, return without adding the broker
-      }
-      mqtt_config->brokers = new_brokers;
-      mqtt_config->broker_capacity = new_capacity;
+    // Create a temporary copy of the current broker connection string
+    char temp[MAX_MQTT_CONNECTION_STRING_LENGTH];
+    if (end - ptr >= (int)sizeof(temp)) {
+      ESP_LOGE(TAG, "Broker connection string too long, skipped");
+    } else {
+      memcpy(temp, ptr, end - ptr);
+      temp[end - ptr] = '\0';
+
+      // Parse the current broker connection string into the next slot
+      parse_mqtt_broker_connection_string(
+          temp, &mqtt_config->brokers[mqtt_config->broker_count++]);
     }
 
-    mqtt_config->brokers[mqtt_config->broker_count++] = config;
-
     // Move to the next broker connection string
     ptr = end;
     if (*ptr == ';') {
       ptr++;
     }
-
-    free(temp);
   }
 
   ESP_LOGD(TAG, "[parse_mqtt_connection_string] parsed %d brokers",
            mqtt_config->broker_count);
 }
-
-void free_mqtt_broker_config(mqtt_broker_config_t *config) {
-  if (config == NULL)
-    return;
-
-  // Free dynamically allocated members
-  free(config->protocol);
-  free(config->host);
-  free(config->username);
-  free(config->password);
-  free(config->client_id);
-  free(config->topic);
-
-  // Set to NULL to avoid double free
-  config->protocol = NULL;
-  config->host = NULL;
-  config->username = NULL;
-  config->password = NULL;
-  config->client_id = NULL;
-  config->topic = NULL;
-}
-
-void free_mqtt_config(mqtt_config_t *mqtt_config) {
-  if (mqtt_config == NULL)
-    return;
-
-  for (int i = 0; i < mqtt_config->broker_count; ++i) {
-    free_mqtt_broker_config(&mqtt_config->brokers[i]);
-  }
-  free(mqtt_config->brokers);
-  mqtt_config->brokers = NULL; // Set to NULL to avoid double free
-}
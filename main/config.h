@@ -9,82 +9,49 @@
 // onewire_config_t functions
 
 /**
- * @brief Creates a new `sensor_config_t` instance.
+ * @brief Resets a `onewire_config_t` instance to an empty configuration.
  *
- * @param address The address of the sensor.
- * @param idx The index of the sensor.
- * @param resolution The resolution of the sensor.
- * @return sensor_config_t* A pointer to the new `sensor_config_t` instance.
- */
-sensor_config_t *create_sensor_config(const char *address, int idx,
-                                      int resolution);
-
-/**
- * @brief Creates a new `bus_config_t` instance.
- *
- * @param pin The pin number for the bus.
- * @return bus_config_t* A pointer to the new `bus_config_t` instance.
- */
-bus_config_t *create_bus_config(int pin);
-
-/**
- * @brief Adds a `sensor_config_t` instance to a `bus_config_t` instance.
- *
- * @param bus A pointer to the `bus_config_t` instance.
- * @param sensor A pointer to the `sensor_config_t` instance.
- * @return void
- */
-void add_sensor_config_to_bus_config(bus_config_t *bus,
-                                     sensor_config_t *sensor);
-
-/**
- * @brief Frees memory allocated for a `sensor_config_t` instance.
- *
- * @param sensor A pointer to the `sensor_config_t` instance.
- * @return void
- */
-void free_sensor_config(sensor_config_t *sensor);
-
-/**
- * @brief Frees memory allocated for a `bus_config_t` instance.
- *
- * @param bus A pointer to the `bus_config_t` instance.
+ * @param config A pointer to the `onewire_config_t` instance.
  * @return void
  */
-void free_bus_config(bus_config_t *bus);
-
-/**
- * @brief Creates a new `onewire_config_t` instance.
- *
- * @return onewire_config_t* A pointer to the new `onewire_config_t` instance.
- */
-onewire_config_t *create_onewire_config();
+void reset_onewire_config(onewire_config_t *config);
 
 /**
- * @brief Adds a `bus_config_t` instance to a `onewire_config_t` instance.
+ * @brief Adds a bus to a `onewire_config_t` instance.
  *
  * @param config A pointer to the `onewire_config_t` instance.
- * @param bus A pointer to the `bus_config_t` instance.
- * @return void
+ * @param pin The pin number for the bus.
+ * @return bus_config_t* A pointer to the new bus, or NULL if the pin is
+ * invalid or `CONFIG_ESP_MAX_BUSES` buses are already configured.
  */
-void add_bus_to_onewire_config(onewire_config_t *config, bus_config_t *bus);
+bus_config_t *add_bus_config(onewire_config_t *config, int pin);
 
 /**
- * @brief Frees memory allocated for a `onewire_config_t` instance.
+ * @brief Adds a sensor to the last bus of a `onewire_config_t` instance.
  *
  * @param config A pointer to the `onewire_config_t` instance.
- * @return void
+ * @param address The ROM code of the sensor.
+ * @param idx The index of the sensor.
+ * @param resolution The resolution of the sensor.
+ * @param period The sampling period of the sensor in seconds, 0 for
+ * `CONFIG_ESP_SLEEP_DURATION`.
+ * @return sensor_config_t* A pointer to the new sensor, or NULL if the
+ * parameters are invalid, no bus is configured or `CONFIG_ESP_MAX_SENSORS`
+ * sensors are already configured.
  */
-void free_onewire_config(onewire_config_t *config);
+sensor_config_t *add_sensor_config(onewire_config_t *config,
+                                   uint64_t address, int idx, int resolution,
+                                   int period);
 
 /**
- * @brief Parses a 1-Wire configuration string and returns a `onewire_config_t`
+ * @brief Parses a 1-Wire configuration string into a `onewire_config_t`
  * instance.
  *
  * @param config_str The configuration string.
- * @return onewire_config_t* A pointer to the new `onewire_config_t` instance.
+ * @param config A pointer to the `onewire_config_t` instance to fill.
+ * @return int The number of buses parsed, or -1 on error.
  */
-onewire_config_t *parse_onewire_config(const char *config_str);
+int parse_onewire_config(const char *config_str, onewire_config_t *config);
 
 // mqtt_config_t functions
 
@@ -103,6 +70,8 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
  * @brief Parses the full MQTT connection string and fills a `mqtt_config_t`
  * instance.
  *
+ * Brokers beyond `CONFIG_ESP_MAX_BROKERS` are ignored.
+ *
  * @param connection_string The connection string.
  * @param mqtt_config A pointer to the `mqtt_config_t` instance.
  * @return void
@@ -110,18 +79,4 @@ void parse_mqtt_broker_connection_string(const char *connection_string,
 void parse_mqtt_connection_string(const char *connection_string,
                                   mqtt_config_t *mqtt_config);
 
-/**
- * @brief Frees memory allocated for a `mqtt_broker_config_t` instance.
- * @param config A pointer to the `mqtt_broker_config_t` instance.
- * @return void
- */
-void free_mqtt_broker_config(mqtt_broker_config_t *config);
-
-/**
- * @brief Frees memory allocated for a `mqtt_config_t` instance.
- * @param mqtt_config A pointer to the `mqtt_config_t` instance.
- * @return void
- */
-void free_mqtt_config(mqtt_config_t *mqtt_config);
-
 #endif // CONFIG_H
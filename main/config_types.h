@@ -1,53 +1,89 @@
 #ifndef CONFIG_TYPES_H
 #define CONFIG_TYPES_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
 #define MAX_SENSOR_ADDRESS_LENGTH                                              \
-  18 ///< Maximum length of a sensor address (16 hex characters + 2 for null
-     ///< terminator)
+  18 ///< Maximum length of a sensor address string (16 hex characters + 2 for
+     ///< null terminator)
+
+#define MAX_MQTT_PROTOCOL_LENGTH 8 ///< "mqtt" or "mqtts" + null terminator
+#define MAX_MQTT_HOST_LENGTH 64    ///< Maximum length of a broker hostname
+#define MAX_MQTT_CREDENTIAL_LENGTH 64 ///< Maximum length of a username,
+                                      ///< password or client ID
+#define MAX_MQTT_TOPIC_LENGTH 128     ///< Maximum length of a topic
+#define MAX_MQTT_CONNECTION_STRING_LENGTH                                      \
+  512 ///< Maximum length of a single broker connection string
 
 /**
  * @brief Represents configuration for a sensor.
  */
 typedef struct {
-  char address[MAX_SENSOR_ADDRESS_LENGTH]; ///< Sensor address
-  int idx;                                 ///< Index of the sensor
-  int resolution;                          ///< Resolution of the sensor
+  uint64_t address; ///< ROM code of the sensor
+  int idx;          ///< Index of the sensor
+  int resolution;   ///< Resolution of the sensor
+  int period;       ///< Sampling period in seconds
 } sensor_config_t;
 
+/**
+ * @brief Represents configuration for a 1-Wire bus.
+ */
 typedef struct {
-  int pin;                   ///< Pin number for the bus
-  sensor_config_t **sensors; ///< Array of pointers to SensorConfig
-  int sensor_count;          ///< Number of sensors on the bus
-  int sensor_capacity;       ///< Capacity of the sensors array
+  int pin;                  ///< Pin number for the bus
+  sensor_config_t *sensors; ///< First sensor of the bus in the sensor array
+                            ///< of the owning `onewire_config_t`
+  int sensor_count;         ///< Number of sensors on the bus
 } bus_config_t;
 
+/**
+ * @brief Represents configuration for all 1-Wire buses.
+ *
+ * Storage is fixed at build time. The sensors of each bus are stored
+ * contiguously, in bus order, so the position of a sensor in `sensors` is
+ * its flat sensor id.
+ */
 typedef struct {
-  bus_config_t **buses; ///< Array of pointers to BusConfig
-  int bus_count;        ///< Number of buses
-  int bus_capacity;     ///< Capacity of the buses array
+  bus_config_t buses[CONFIG_ESP_MAX_BUSES];          ///< Bus configurations
+  int bus_count;                                     ///< Number of buses
+  sensor_config_t sensors[CONFIG_ESP_MAX_SENSORS];   ///< Sensor configurations
+  int sensor_count;                                  ///< Number of sensors
 } onewire_config_t;
 
+/**
+ * @brief Encoding of the readings published to a broker.
+ */
+typedef enum {
+  MQTT_PAYLOAD_JSON, ///< One JSON message per reading
+  MQTT_PAYLOAD_CBOR, ///< One CBOR message per cycle, see payload.h
+} mqtt_payload_format_t;
+
 /**
  * @brief Represents configuration for a MQTT broker.
+ *
+ * Optional fields are empty strings when not set.
  */
 typedef struct {
-  char *protocol;  ///< Protocol (e.g., "mqtt" or "mqtts")
-  char *host;      ///< Hostname or IP address of the broker
-  int port;        ///< Port number of the broker
-  char *username;  ///< Username for authentication (if any)
-  char *password;  ///< Password for authentication (if any)
-  char *client_id; ///< Client ID for MQTT connection (if any)
-  char *topic;     ///< Topic to publish sensor readings to
+  char protocol[MAX_MQTT_PROTOCOL_LENGTH]; ///< Protocol ("mqtt" or "mqtts")
+  char host[MAX_MQTT_HOST_LENGTH]; ///< Hostname or IP address of the broker
+  int port;                        ///< Port number of the broker
+  char username[MAX_MQTT_CREDENTIAL_LENGTH]; ///< Username for authentication
+  char password[MAX_MQTT_CREDENTIAL_LENGTH]; ///< Password for authentication
+  char client_id[MAX_MQTT_CREDENTIAL_LENGTH]; ///< Client ID for MQTT connection
+  char topic[MAX_MQTT_TOPIC_LENGTH]; ///< Topic to publish sensor readings to,
+                                     ///< may hold placeholders, see topics.h
+  mqtt_payload_format_t format;      ///< Encoding of the readings
+  bool retain; ///< Readings are published as retained messages
 } mqtt_broker_config_t;
 
 /**
  * @brief Represents configuration for MQTT connections.
  */
 typedef struct {
-  mqtt_broker_config_t *brokers; ///< Array of MQTT broker configurations
-  int broker_count;              ///< Number of MQTT brokers
-  int broker_capacity;           ///< Capacity of the brokers array
+  mqtt_broker_config_t brokers[CONFIG_ESP_MAX_BROKERS]; ///< MQTT brokers
+  int broker_count; ///< Number of MQTT brokers
 } mqtt_config_t;
 
-
-#endif // CONFIG_TYPES_H
\ No newline at end of file
+#endif // CONFIG_TYPES_H
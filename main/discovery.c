@@ -0,0 +1,264 @@
+#include "discovery.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "config.h"
+#include "sensor.h"
+#include "utils.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) && defined(CONFIG_ESP_AUTO_DISCOVERY)
+
+static const char *TAG = "discovery";
+
+#define DISCOVERY_NVS_NAMESPACE "discovery"
+#define DISCOVERY_NVS_KEY "roms"
+#define DISCOVERY_ALL_BUSES 0xFFFFFFFF
+
+// Buses to search at the next pool creation, one bit per bus
+RTC_DATA_ATTR static uint32_t s_requested = 0;
+
+// Cycles since the populated buses were last searched
+RTC_DATA_ATTR static uint32_t s_cycles = 0;
+
+static discovery_entry_t s_table[CONFIG_ESP_MAX_SENSORS];
+static int s_count = 0;
+static bool s_loaded = false;
+
+static esp_err_t load_table(void) {
+  nvs_handle_t handle;
+  s_count = 0;
+  s_loaded = false;
+
+  esp_err_t err = nvs_open(DISCOVERY_NVS_NAMESPACE, NVS_READONLY, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  size_t size = sizeof(s_table);
+  err = nvs_get_blob(handle, DISCOVERY_NVS_KEY, s_table, &size);
+  nvs_close(handle);
+
+  if (err != ESP_OK || size % sizeof(discovery_entry_t) != 0) {
+    return err != ESP_OK ? err : ESP_ERR_INVALID_SIZE;
+  }
+
+  s_count = size / sizeof(discovery_entry_t);
+  s_loaded = true;
+  return ESP_OK;
+}
+
+static esp_err_t save_table(void) {
+  nvs_handle_t handle;
+  ESP_RETURN_ON_ERROR(
+      nvs_open(DISCOVERY_NVS_NAMESPACE, NVS_READWRITE, &handle), TAG,
+      "Failed to open NVS");
+
+  esp_err_t err = nvs_set_blob(handle, DISCOVERY_NVS_KEY, s_table,
+                               s_count * sizeof(discovery_entry_t));
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (err == ESP_OK) {
+    s_loaded = true;
+    ESP_LOGI(TAG, "Stored %d discovered sensors", s_count);
+  }
+
+  return err;
+}
+
+static discovery_entry_t *find_entry(uint64_t rom) {
+  for (int i = 0; i < s_count; i++) {
+    if (s_table[i].rom == rom) {
+      return &s_table[i];
+    }
+  }
+  return NULL;
+}
+
+static uint16_t next_idx(void) {
+  int idx = CONFIG_ESP_DISCOVERY_FIRST_IDX;
+  for (int i = 0; i < s_count; i++) {
+    if (s_table[i].idx >= idx) {
+      idx = s_table[i].idx + 1;
+    }
+  }
+  return idx;
+}
+
+/**
+ * Returns a free entry. When the table is full, the first absent sensor
+ * gives up its entry. Returns NULL if every sensor is present.
+ */
+static discovery_entry_t *allocate_entry(void) {
+  if (s_count < CONFIG_ESP_MAX_SENSORS) {
+    return &s_table[s_count++];
+  }
+
+  for (int i = 0; i < s_count; i++) {
+    if (!s_table[i].present) {
+      ESP_LOGW(TAG, "Table full, forgetting absent sensor %016llX",
+               s_table[i].rom);
+      return &s_table[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Searches one bus and updates its entries. Returns false if the table did
+ * not change.
+ */
+static bool search_bus(onewire_bus_handle_t bus_handle, int bus) {
+  onewire_device_iter_handle_t iter = NULL;
+  onewire_device_t device;
+  // Static, large tables would not fit on the stack
+  static bool found[CONFIG_ESP_MAX_SENSORS];
+  bool changed = false;
+  esp_err_t err;
+
+  memset(found, 0, sizeof(found));
+  if (onewire_new_device_iter(bus_handle, &iter) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to search bus %d", bus);
+    return false;
+  }
+
+  while ((err = onewire_device_iter_get_next(iter, &device)) == ESP_OK) {
+    if ((device.address & 0xFF) != DS18B20_FAMILY_CODE) {
+      ESP_LOGD(TAG, "Ignoring device %016llX", device.address);
+      continue;
+    }
+
+    discovery_entry_t *entry = find_entry(device.address);
+    if (entry == NULL) {
+      uint16_t idx = next_idx();
+      entry = allocate_entry();
+      if (entry == NULL) {
+        ESP_LOGE(TAG, "Too many sensors, ignoring %016llX", device.address);
+        continue;
+      }
+      *entry = (discovery_entry_t){
+          .rom = device.address,
+          .idx = idx,
+          .bus = bus,
+      };
+      ESP_LOGI(TAG, "New sensor %016llX on bus %d, idx %d", entry->rom, bus,
+               entry->idx);
+      changed = true;
+    } else if (!entry->present || entry->bus != bus) {
+      ESP_LOGI(TAG, "Sensor %016llX back on bus %d, idx %d", entry->rom, bus,
+               entry->idx);
+      entry->bus = bus;
+      changed = true;
+    }
+
+    entry->present = true;
+    found[entry - s_table] = true;
+  }
+  onewire_del_device_iter(iter);
+
+  if (err != ESP_ERR_NOT_FOUND) {
+    // Incomplete search, only additions can be trusted
+    ESP_LOGE(TAG, "Search of bus %d failed: %s", bus, esp_err_to_name(err));
+    return changed;
+  }
+
+  for (int i = 0; i < s_count; i++) {
+    if (s_table[i].bus == bus && s_table[i].present && !found[i]) {
+      ESP_LOGW(TAG, "Sensor %016llX (idx %d) gone from bus %d", s_table[i].rom,
+               s_table[i].idx, bus);
+      s_table[i].present = false;
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+int discovery_load_config(onewire_config_t *config) {
+  int pins[CONFIG_ESP_MAX_BUSES];
+  int num_pins = str_to_int_array(CONFIG_ESP_DISCOVERY_GPIO, ',', pins,
+                                  CONFIG_ESP_MAX_BUSES);
+  if (num_pins <= 0) {
+    ESP_LOGE(TAG, "No discovery GPIO configured");
+    return -1;
+  }
+
+  if (!s_loaded && load_table() != ESP_OK) {
+    ESP_LOGI(TAG, "No discovered sensors stored, searching every bus");
+    s_requested = DISCOVERY_ALL_BUSES;
+  }
+
+  reset_onewire_config(config);
+  for (int bus = 0; bus < num_pins; bus++) {
+    if (add_bus_config(config, pins[bus]) == NULL) {
+      return -1;
+    }
+
+    for (int i = 0; i < s_count; i++) {
+      if (s_table[i].bus != bus || !s_table[i].present) {
+        continue;
+      }
+
+      if (add_sensor_config(config, s_table[i].rom, s_table[i].idx,
+                            CONFIG_ESP_DISCOVERY_RESOLUTION, 0) == NULL) {
+        return -1;
+      }
+    }
+  }
+
+  return config->bus_count;
+}
+
+bool discovery_pending(void) { return s_requested != 0; }
+
+void discovery_request(int bus) {
+  if (bus < 0) {
+    s_requested = DISCOVERY_ALL_BUSES;
+  } else if (bus < CONFIG_ESP_MAX_BUSES) {
+    s_requested |= 1u << bus;
+  }
+}
+
+bool discovery_requested(int bus) {
+  return bus >= 0 && bus < CONFIG_ESP_MAX_BUSES &&
+         (s_requested & (1u << bus)) != 0;
+}
+
+bool discovery_count_cycle(void) {
+#if CONFIG_ESP_DISCOVERY_INTERVAL > 0
+  if (++s_cycles >= CONFIG_ESP_DISCOVERY_INTERVAL) {
+    s_cycles = 0;
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool discovery_search(onewire_bus_handle_t bus_handle, int bus) {
+  if (bus >= 0 && bus < CONFIG_ESP_MAX_BUSES) {
+    s_requested &= ~(1u << bus);
+  }
+
+  ESP_LOGI(TAG, "Searching bus %d", bus);
+  return search_bus(bus_handle, bus);
+}
+
+esp_err_t discovery_commit(onewire_config_t *config, bool changed) {
+  s_requested = 0;
+
+  if (!changed && s_loaded) {
+    return ESP_OK;
+  }
+
+  ESP_RETURN_ON_ERROR(save_table(), TAG, "Failed to store the sensors");
+
+  return discovery_load_config(config) < 0 ? ESP_FAIL : ESP_OK;
+}
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_AUTO_DISCOVERY
@@ -0,0 +1,105 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "config_types.h"
+#include "onewire_bus.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) && defined(CONFIG_ESP_AUTO_DISCOVERY)
+
+/**
+ * @brief A discovered sensor, as stored in NVS.
+ *
+ * Sensors that disappear stay in the table, so a sensor that comes back gets
+ * its previous idx.
+ */
+typedef struct __attribute__((packed)) {
+  uint64_t rom;  ///< ROM code of the sensor
+  uint16_t idx;  ///< Index assigned to the sensor
+  uint8_t bus;   ///< Position of the bus in `CONFIG_ESP_DISCOVERY_GPIO`
+  bool present;  ///< Whether the sensor answered the last search of its bus
+} discovery_entry_t;
+
+/**
+ * @brief Builds the 1-Wire configuration from the discovered sensors.
+ *
+ * The buses come from `CONFIG_ESP_DISCOVERY_GPIO` and the sensors from the
+ * table stored in NVS. Every sensor uses `CONFIG_ESP_DISCOVERY_RESOLUTION`.
+ *
+ * @param config A pointer to the `onewire_config_t` instance to fill.
+ * @return int The number of buses, or -1 on error.
+ */
+int discovery_load_config(onewire_config_t *config);
+
+/**
+ * @brief Returns whether a bus should be searched before reading.
+ *
+ * True when no table is stored yet, or when a search was requested with
+ * `discovery_request()`.
+ *
+ * @return true if a bus should be searched with `discovery_search()`.
+ */
+bool discovery_pending(void);
+
+/**
+ * @brief Requests a search of a bus at the next pool creation.
+ *
+ * The request is kept in RTC memory, so it survives deep sleep.
+ *
+ * @param bus Position of the bus, or -1 for every bus.
+ * @return void
+ */
+void discovery_request(int bus);
+
+/**
+ * @brief Returns whether a search of a bus was requested.
+ *
+ * @param bus Position of the bus.
+ * @return true if `discovery_search()` should be called for this bus.
+ */
+bool discovery_requested(int bus);
+
+/**
+ * @brief Counts a cycle and tells whether the populated buses are due for a
+ * search.
+ *
+ * A sensor added to a bus that already has sensors is only found by a search.
+ * The count is kept in RTC memory.
+ *
+ * @return true once every `CONFIG_ESP_DISCOVERY_INTERVAL` cycles, never when
+ * it is 0.
+ */
+bool discovery_count_cycle(void);
+
+/**
+ * @brief Searches a bus and updates the table.
+ *
+ * Sensors found for the first time get the next free idx, starting at
+ * `CONFIG_ESP_DISCOVERY_FIRST_IDX`. A bus whose search fails keeps its
+ * previous entries. The request of the bus is cleared.
+ *
+ * @param bus_handle The handle of the bus, attached.
+ * @param bus Position of the bus.
+ * @return true if the table changed.
+ */
+bool discovery_search(onewire_bus_handle_t bus_handle, int bus);
+
+/**
+ * @brief Stores the table and rebuilds the configuration after a search.
+ *
+ * The remaining requests are cleared. The table is only written to NVS when
+ * it changed, or when no table was stored yet.
+ *
+ * @param config The configuration, rebuilt when the table changed.
+ * @param changed Whether one of the searches changed the table.
+ * @return ESP_OK on success, otherwise an error code from NVS.
+ */
+esp_err_t discovery_commit(onewire_config_t *config, bool changed);
+
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_AUTO_DISCOVERY
+
+#endif // DISCOVERY_H
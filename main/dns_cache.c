@@ -0,0 +1,128 @@
+#include "dns_cache.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "dns_cache";
+
+RTC_DATA_ATTR static dns_cache_entry_t
+    s_dns_cache[CONFIG_ESP_MQTT_DNS_CACHE_SIZE];
+
+static dns_cache_entry_t *find_entry(const char *host) {
+  for (int i = 0; i < CONFIG_ESP_MQTT_DNS_CACHE_SIZE; i++) {
+    if (s_dns_cache[i].valid && strcmp(s_dns_cache[i].host, host) == 0) {
+      return &s_dns_cache[i];
+    }
+  }
+  return NULL;
+}
+
+static dns_cache_entry_t *allocate_entry(void) {
+  dns_cache_entry_t *oldest = &s_dns_cache[0];
+  for (int i = 0; i < CONFIG_ESP_MQTT_DNS_CACHE_SIZE; i++) {
+    if (!s_dns_cache[i].valid) {
+      return &s_dns_cache[i];
+    }
+    if (s_dns_cache[i].expires_at < oldest->expires_at) {
+      oldest = &s_dns_cache[i];
+    }
+  }
+
+  // Cache is full, evict the entry closest to expiry
+  return oldest;
+}
+
+static esp_err_t lookup(const char *host, uint32_t *addr) {
+  const struct addrinfo hints = {
+      .ai_family = AF_INET,
+      .ai_socktype = SOCK_STREAM,
+  };
+  struct addrinfo *res = NULL;
+
+  int err = getaddrinfo(host, NULL, &hints, &res);
+  if (err != 0 || res == NULL) {
+    ESP_LOGE(TAG, "DNS lookup failed for %s: %d", host, err);
+    if (res != NULL) {
+      freeaddrinfo(res);
+    }
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(res);
+
+  return ESP_OK;
+}
+
+esp_err_t dns_cache_resolve(const char *host, char *ip, size_t ip_len) {
+  if (host == NULL || ip == NULL || ip_len < DNS_CACHE_MAX_IP_LENGTH) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Nothing to resolve for IP literals
+  struct in_addr literal;
+  if (inet_aton(host, &literal)) {
+    strncpy(ip, host, ip_len - 1);
+    ip[ip_len - 1] = '\0';
+    return ESP_OK;
+  }
+
+  time_t now = time(NULL);
+  struct in_addr in;
+
+  dns_cache_entry_t *entry = find_entry(host);
+  if (entry != NULL && now < entry->expires_at) {
+    in.s_addr = entry->addr;
+    inet_ntoa_r(in, ip, ip_len);
+    ESP_LOGD(TAG, "Cache hit for %s: %s (expires in %lld s)", host, ip,
+             (long long)(entry->expires_at - now));
+    return ESP_OK;
+  }
+
+  ESP_LOGD(TAG, "Cache %s for %s, resolving", entry ? "expired" : "miss",
+           host);
+
+  uint32_t addr;
+  esp_err_t err = lookup(host, &addr);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  in.s_addr = addr;
+  inet_ntoa_r(in, ip, ip_len);
+
+  if (strlen(host) >= DNS_CACHE_MAX_HOST_LENGTH) {
+    ESP_LOGW(TAG, "Hostname %s too long to be cached", host);
+    return ESP_OK;
+  }
+
+  if (entry == NULL) {
+    entry = allocate_entry();
+  }
+
+  strcpy(entry->host, host);
+  entry->addr = addr;
+  entry->expires_at = now + CONFIG_ESP_MQTT_DNS_CACHE_TTL;
+  entry->valid = true;
+
+  ESP_LOGI(TAG, "Resolved %s to %s", host, ip);
+
+  return ESP_OK;
+}
+
+void dns_cache_invalidate(const char *host) {
+  if (host == NULL) {
+    return;
+  }
+
+  dns_cache_entry_t *entry = find_entry(host);
+  if (entry != NULL) {
+    ESP_LOGI(TAG, "Invalidating cached address for %s", host);
+    entry->valid = false;
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "esp_err.h"
+
+#define DNS_CACHE_MAX_HOST_LENGTH 64 ///< Maximum hostname length (incl. null)
+#define DNS_CACHE_MAX_IP_LENGTH 16   ///< Dotted IPv4 string length (incl. null)
+
+/**
+ * @brief Represents a resolved broker hostname.
+ *
+ * Entries live in RTC slow memory so they survive deep sleep. They are
+ * discarded on a power-on reset together with the rest of the RTC memory.
+ */
+typedef struct {
+  char host[DNS_CACHE_MAX_HOST_LENGTH]; ///< Hostname as configured
+  uint32_t addr;                        ///< IPv4 address (network order)
+  time_t expires_at;                    ///< Expiry time (RTC wall clock)
+  bool valid;                           ///< Whether the entry is in use
+} dns_cache_entry_t;
+
+/**
+ * @brief Resolves a hostname to a dotted IPv4 string, using the RTC cache.
+ *
+ * IP literals are returned as-is without touching the cache. A valid, non
+ * expired cache entry is returned without any network traffic. Otherwise
+ * the hostname is resolved through lwIP and the result is cached for
+ * `CONFIG_ESP_MQTT_DNS_CACHE_TTL` seconds.
+ *
+ * @param host The hostname to resolve.
+ * @param ip Buffer receiving the dotted IPv4 address.
+ * @param ip_len Size of the `ip` buffer.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the lookup failed or
+ * ESP_ERR_INVALID_ARG on invalid parameters.
+ */
+esp_err_t dns_cache_resolve(const char *host, char *ip, size_t ip_len);
+
+/**
+ * @brief Drops the cached address for a hostname.
+ *
+ * Used after a failed connection so the next `dns_cache_resolve()` call
+ * performs a fresh lookup.
+ *
+ * @param host The hostname to invalidate.
+ * @return void
+ */
+void dns_cache_invalidate(const char *host);
+
+#endif // DNS_CACHE_H
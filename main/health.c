@@ -0,0 +1,209 @@
+#include "health.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+#define HEALTH_SENTINEL_RAW (85 * 16)  ///< Power-on reset value
+#define HEALTH_MIN_RAW (-55 * 16)      ///< Lowest temperature of the DS18B20
+#define HEALTH_MAX_RAW (125 * 16)      ///< Highest temperature of the DS18B20
+
+static const char *TAG = "health";
+
+SENSOR_STATE_ATTR static health_sensor_t s_sensors[CONFIG_ESP_MAX_SENSORS];
+
+static bool valid_sensor(int sensor) {
+  return sensor >= 0 && sensor < CONFIG_ESP_MAX_SENSORS;
+}
+
+static void transition(int sensor, health_state_t state,
+                       health_reason_t reason) {
+  health_sensor_t *s = &s_sensors[sensor];
+
+  if (s->state == state && s->reason == reason) {
+    return;
+  }
+
+  ESP_LOGW(TAG, "Sensor %d: %s -> %s (%s)", sensor,
+           health_state_name(s->state), health_state_name(state),
+           health_reason_name(reason));
+
+  if (!s->event_pending) {
+    s->event_pending = true;
+    s->event_from = s->state;
+  } else if (s->event_from == state) {
+    // Back where it was before the unpublished transition
+    s->event_pending = false;
+  }
+  s->state = state;
+  s->reason = reason;
+}
+
+static void reject(int sensor, health_reason_t reason) {
+  health_sensor_t *s = &s_sensors[sensor];
+
+  if (s->failures < UINT8_MAX) {
+    s->failures++;
+  }
+
+  if (s->failures < CONFIG_ESP_HEALTH_FAULT_THRESHOLD) {
+    transition(sensor, HEALTH_SUSPECT, reason);
+  } else if (reason == HEALTH_REASON_ABSENT) {
+    transition(sensor, HEALTH_MISSING, reason);
+  } else {
+    transition(sensor, HEALTH_FAULTED, reason);
+  }
+}
+
+/**
+ * Returns whether the reading changed faster than the allowed rate since the
+ * previous one.
+ */
+static bool exceeds_rate(const health_sensor_t *s, int16_t raw, time_t now) {
+  if (!s->has_last) {
+    return false;
+  }
+
+  long minutes = (now - s->last_time + 59) / 60;
+  if (minutes < 1) {
+    minutes = 1;
+  }
+
+  // Sixteenths of a degree to hundredths
+  long delta = labs((long)raw - s->last_raw) * 100 / 16;
+  return delta > (long)CONFIG_ESP_HEALTH_MAX_RATE * minutes;
+}
+
+bool health_check_reading(int sensor, int16_t raw, time_t now) {
+  if (!valid_sensor(sensor)) {
+    return true;
+  }
+
+  health_sensor_t *s = &s_sensors[sensor];
+
+  if (raw == HEALTH_SENTINEL_RAW) {
+    reject(sensor, HEALTH_REASON_SENTINEL);
+    return false;
+  }
+
+  if (raw < HEALTH_MIN_RAW || raw > HEALTH_MAX_RAW) {
+    reject(sensor, HEALTH_REASON_IMPLAUSIBLE);
+    return false;
+  }
+
+  bool too_fast = exceeds_rate(s, raw, now);
+  bool repeated = s->has_last && raw == s->last_raw;
+
+  // A genuine step is accepted once the next reading confirms it
+  s->repeats = repeated && s->repeats < UINT16_MAX ? s->repeats + 1 : 0;
+  s->last_raw = raw;
+  s->last_time = (uint32_t)now;
+  s->has_last = true;
+
+  if (too_fast) {
+    reject(sensor, HEALTH_REASON_RATE);
+    return false;
+  }
+
+  s->failures = 0;
+
+  if (CONFIG_ESP_HEALTH_STUCK_READINGS > 0 &&
+      s->repeats >= CONFIG_ESP_HEALTH_STUCK_READINGS) {
+    transition(sensor, HEALTH_SUSPECT, HEALTH_REASON_STUCK);
+  } else {
+    transition(sensor, HEALTH_OK, HEALTH_REASON_NONE);
+  }
+
+  return true;
+}
+
+void health_record_failure(int sensor) {
+  if (valid_sensor(sensor)) {
+    reject(sensor, HEALTH_REASON_ABSENT);
+  }
+}
+
+bool health_is_excluded(int sensor) {
+  if (!valid_sensor(sensor)) {
+    return false;
+  }
+
+  return s_sensors[sensor].state == HEALTH_FAULTED ||
+         s_sensors[sensor].state == HEALTH_MISSING;
+}
+
+health_state_t health_get_state(int sensor) {
+  return valid_sensor(sensor) ? s_sensors[sensor].state : HEALTH_OK;
+}
+
+bool health_get_event(int sensor, health_event_t *event) {
+  if (!valid_sensor(sensor) || !s_sensors[sensor].event_pending) {
+    return false;
+  }
+
+  *event = (health_event_t){
+      .from = s_sensors[sensor].event_from,
+      .to = s_sensors[sensor].state,
+      .reason = s_sensors[sensor].reason,
+  };
+  return true;
+}
+
+bool health_has_events(int num_sensors) {
+  for (int i = 0; i < num_sensors && i < CONFIG_ESP_MAX_SENSORS; i++) {
+    if (s_sensors[i].event_pending) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void health_clear_events(const bool *unsent) {
+  for (int i = 0; i < CONFIG_ESP_MAX_SENSORS; i++) {
+    if (unsent == NULL || !unsent[i]) {
+      s_sensors[i].event_pending = false;
+    }
+  }
+}
+
+void health_reset(void) { memset(s_sensors, 0, sizeof(s_sensors)); }
+
+const char *health_state_name(health_state_t state) {
+  switch (state) {
+  case HEALTH_OK:
+    return "ok";
+  case HEALTH_SUSPECT:
+    return "suspect";
+  case HEALTH_FAULTED:
+    return "faulted";
+  case HEALTH_MISSING:
+    return "missing";
+  default:
+    return "unknown";
+  }
+}
+
+const char *health_reason_name(health_reason_t reason) {
+  switch (reason) {
+  case HEALTH_REASON_NONE:
+    return "none";
+  case HEALTH_REASON_SENTINEL:
+    return "sentinel";
+  case HEALTH_REASON_IMPLAUSIBLE:
+    return "implausible";
+  case HEALTH_REASON_RATE:
+    return "rate";
+  case HEALTH_REASON_STUCK:
+    return "stuck";
+  case HEALTH_REASON_ABSENT:
+    return "absent";
+  default:
+    return "unknown";
+  }
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,151 @@
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Health of a sensor.
+ */
+typedef enum {
+  HEALTH_OK = 0,  ///< Readings are accepted
+  HEALTH_SUSPECT, ///< A recent reading was rejected or is stuck
+  HEALTH_FAULTED, ///< Readings have been rejected repeatedly
+  HEALTH_MISSING, ///< The sensor has not answered repeatedly
+} health_state_t;
+
+/**
+ * @brief Why a sensor left the ok state.
+ */
+typedef enum {
+  HEALTH_REASON_NONE = 0,    ///< The sensor is healthy
+  HEALTH_REASON_SENTINEL,    ///< Power-on reset value (85 °C)
+  HEALTH_REASON_IMPLAUSIBLE, ///< Outside the range of the DS18B20
+  HEALTH_REASON_RATE,        ///< Changed faster than the allowed rate
+  HEALTH_REASON_STUCK,       ///< Same value for too many readings
+  HEALTH_REASON_ABSENT,      ///< The sensor could not be read
+} health_reason_t;
+
+/**
+ * @brief The health tracking state of a sensor, kept across deep sleep.
+ */
+typedef struct {
+  uint32_t last_time;        ///< When `last_raw` was read (RTC wall clock)
+  uint16_t repeats;          ///< Consecutive readings equal to `last_raw`
+  int16_t last_raw;          ///< Last reading, in sixteenths of a degree
+  uint8_t reason;            ///< `health_reason_t` of the current state
+  uint8_t failures;          ///< Consecutive rejected or failed readings
+  uint8_t state : 4;         ///< Current `health_state_t`
+  uint8_t event_from : 4;    ///< State before the first unpublished transition
+  uint8_t has_last : 1;      ///< Whether `last_raw` holds a reading
+  uint8_t event_pending : 1; ///< Whether a transition waits to be published
+} health_sensor_t;
+
+/**
+ * @brief A health transition waiting to be published.
+ */
+typedef struct {
+  health_state_t from;    ///< State before the transition
+  health_state_t to;      ///< State after the transition
+  health_reason_t reason; ///< Reason of the new state
+} health_event_t;
+
+/**
+ * @brief Classifies a reading and updates the health of the sensor.
+ *
+ * Readings equal to the power-on reset value, outside the range of the
+ * sensor, or changing faster than `CONFIG_ESP_HEALTH_MAX_RATE` are rejected.
+ * A reading repeated `CONFIG_ESP_HEALTH_STUCK_READINGS` times is accepted but
+ * marks the sensor as suspect.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param raw The reading, in sixteenths of a degree.
+ * @param now The current time (RTC wall clock).
+ * @return true if the reading should be published.
+ */
+bool health_check_reading(int sensor, int16_t raw, time_t now);
+
+/**
+ * @brief Records that a sensor could not be read.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @return void
+ */
+void health_record_failure(int sensor);
+
+/**
+ * @brief Returns whether a sensor is faulted or missing.
+ *
+ * Such sensors are only probed every `CONFIG_ESP_HEALTH_PROBE_INTERVAL`
+ * seconds and are not retried within a cycle.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @return true if the sensor is excluded from the regular schedule.
+ */
+bool health_is_excluded(int sensor);
+
+/**
+ * @brief Returns the health of a sensor.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @return health_state_t The current state.
+ */
+health_state_t health_get_state(int sensor);
+
+/**
+ * @brief Returns the unpublished transition of a sensor, if any.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param event Receives the transition.
+ * @return true if the sensor has an unpublished transition.
+ */
+bool health_get_event(int sensor, health_event_t *event);
+
+/**
+ * @brief Returns whether any sensor has an unpublished transition.
+ *
+ * @param num_sensors The number of configured sensors.
+ * @return true if at least one transition is waiting to be published.
+ */
+bool health_has_events(int num_sensors);
+
+/**
+ * @brief Marks the transitions as published, except those of `unsent`.
+ *
+ * @param unsent whether the transition of each configured sensor could not
+ * be published and stays pending for the next cycle, or NULL for none.
+ * @return void
+ */
+void health_clear_events(const bool *unsent);
+
+/**
+ * @brief Forgets the health of every sensor.
+ *
+ * Called when the sensors are renumbered, e.g. after a discovery.
+ *
+ * @return void
+ */
+void health_reset(void);
+
+/**
+ * @brief Returns the name of a health state.
+ *
+ * @param state The state.
+ * @return const char* The name (e.g. "faulted").
+ */
+const char *health_state_name(health_state_t state);
+
+/**
+ * @brief Returns the name of a health reason.
+ *
+ * @param reason The reason.
+ * @return const char* The name (e.g. "sentinel").
+ */
+const char *health_reason_name(health_reason_t reason);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // HEALTH_H
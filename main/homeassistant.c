@@ -0,0 +1,314 @@
+#include "homeassistant.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "telemetry.h"
+#include "topics.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) &&                                       \
+    defined(CONFIG_ESP_HOMEASSISTANT_DISCOVERY)
+
+static const char *TAG = "homeassistant";
+
+#define HOMEASSISTANT_NVS_NAMESPACE "homeassistant"
+#define HOMEASSISTANT_NVS_KEY "hash%d"      ///< One hash per broker
+#define HOMEASSISTANT_NVS_ROMS_KEY "roms%d" ///< Sensors published, per broker
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+// Readings of every sensor share the broker topic, HA tells them apart by idx
+#ifdef CONFIG_ESP_MQTT_DOMOTICZ_INTEGRATION
+#define HOMEASSISTANT_READING_VALUE "value_json.svalue | float"
+#else
+#define HOMEASSISTANT_READING_VALUE "value_json.temperature"
+#endif
+
+#define HOMEASSISTANT_DEVICE                                                   \
+  "\"device\":{\"identifiers\":[\"%s\"], \"name\":\"%s\", "                    \
+  "\"manufacturer\":\"SNOW\", \"model\":\"ESP32 DS18B20\"}"
+
+/**
+ * @brief A device diagnostic, read from the telemetry message.
+ */
+typedef struct {
+  const char *key;          ///< Object id, and end of the unique id
+  const char *name;         ///< Name of the entity
+  const char *value;        ///< Path of the value in the telemetry message
+  const char *unit;         ///< Unit of measurement
+  const char *device_class; ///< Home Assistant device class
+} diagnostic_t;
+
+static const diagnostic_t s_diagnostics[] = {
+    {"rssi", "RSSI", "wifi.rssi", "dBm", "signal_strength"},
+    {"cycle_time", "Cycle time", "last_cycle_ms", "ms", "duration"},
+};
+
+#define HOMEASSISTANT_DIAGNOSTIC_COUNT                                         \
+  ((int)(sizeof(s_diagnostics) / sizeof(s_diagnostics[0])))
+
+// Hash of the last configuration published to each broker, 0 when unknown
+RTC_DATA_ATTR static uint32_t s_published[CONFIG_ESP_MAX_BROKERS];
+
+static char s_payload[HOMEASSISTANT_MAX_PAYLOAD_LENGTH];
+
+// ROM codes of the sensors last published to a broker
+static uint64_t s_roms[CONFIG_ESP_MAX_SENSORS];
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static uint32_t hash_string(uint32_t hash, const char *string) {
+  // The terminator keeps "ab" + "c" apart from "a" + "bc"
+  return hash_bytes(hash, string, strlen(string) + 1);
+}
+
+/**
+ * Hashes everything the config messages are built from.
+ */
+static uint32_t config_hash(const mqtt_broker_config_t *config,
+                            const device_table_t *devices, int num_sensors) {
+  int schema = HOMEASSISTANT_SCHEMA;
+  uint32_t hash = hash_bytes(FNV_OFFSET_BASIS, &schema, sizeof(schema));
+  hash = hash_string(hash, CONFIG_ESP_HOMEASSISTANT_PREFIX);
+  hash = hash_string(hash, CONFIG_ESP_MQTT_TELEMETRY_TOPIC);
+  hash = hash_string(hash, HOMEASSISTANT_READING_VALUE);
+  hash = hash_string(hash, config->topic);
+  hash = hash_string(hash, telemetry_device_id());
+
+  // Every configured sensor, whether or not it answers this cycle
+  for (int i = 0; i < num_sensors; i++) {
+    hash = hash_bytes(hash, &devices->rom[i], sizeof(devices->rom[i]));
+    hash = hash_bytes(hash, &devices->idx[i], sizeof(devices->idx[i]));
+    hash = hash_bytes(hash, &devices->bus[i], sizeof(devices->bus[i]));
+  }
+
+  return hash;
+}
+
+static void load_hash(int broker) {
+  nvs_handle_t handle;
+  char key[16];
+
+  if (nvs_open(HOMEASSISTANT_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    // Nothing published yet
+    return;
+  }
+  snprintf(key, sizeof(key), HOMEASSISTANT_NVS_KEY, broker);
+  if (nvs_get_u32(handle, key, &s_published[broker]) != ESP_OK) {
+    s_published[broker] = 0;
+  }
+  nvs_close(handle);
+}
+
+/**
+ * Loads the ROM codes of the sensors last published to a broker into
+ * `s_roms`. Returns their number, 0 when unknown.
+ */
+static int load_roms(int broker) {
+  nvs_handle_t handle;
+  char key[16];
+  size_t size = sizeof(s_roms);
+
+  if (nvs_open(HOMEASSISTANT_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return 0;
+  }
+  snprintf(key, sizeof(key), HOMEASSISTANT_NVS_ROMS_KEY, broker);
+  if (nvs_get_blob(handle, key, s_roms, &size) != ESP_OK) {
+    size = 0;
+  }
+  nvs_close(handle);
+  return size / sizeof(s_roms[0]);
+}
+
+static esp_err_t save_hash(int broker, uint32_t hash,
+                           const device_table_t *devices, int num_sensors) {
+  nvs_handle_t handle;
+  char key[16];
+
+  ESP_RETURN_ON_ERROR(
+      nvs_open(HOMEASSISTANT_NVS_NAMESPACE, NVS_READWRITE, &handle), TAG,
+      "Failed to open NVS");
+
+  snprintf(key, sizeof(key), HOMEASSISTANT_NVS_ROMS_KEY, broker);
+  esp_err_t err = nvs_set_blob(handle, key, devices->rom,
+                               num_sensors * sizeof(devices->rom[0]));
+  if (err == ESP_OK) {
+    snprintf(key, sizeof(key), HOMEASSISTANT_NVS_KEY, broker);
+    err = nvs_set_u32(handle, key, hash);
+  }
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (err == ESP_OK) {
+    s_published[broker] = hash;
+  }
+  return err;
+}
+
+/**
+ * Publishes the config of an entity, or removes the entity when `payload` is
+ * empty.
+ */
+static esp_err_t publish_retained(MQTT_Client *mqtt_client, const char *object,
+                                  const char *payload) {
+  char topic[MAX_MQTT_TOPIC_LENGTH];
+
+  snprintf(topic, sizeof(topic), "%s/sensor/%s/%s/config",
+           CONFIG_ESP_HOMEASSISTANT_PREFIX, telemetry_device_id(), object);
+
+  // Retained, so Home Assistant finds the entities whenever it starts
+  esp_err_t err = mqtt_publish_retained(mqtt_client, topic, payload);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to publish %s", topic);
+  }
+  return err;
+}
+
+static esp_err_t publish_config(MQTT_Client *mqtt_client, const char *object,
+                                int length) {
+  if (length < 0 || length >= (int)sizeof(s_payload)) {
+    ESP_LOGE(TAG, "Config payload of %s too long", object);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return publish_retained(mqtt_client, object, s_payload);
+}
+
+static esp_err_t publish_sensor(MQTT_Client *mqtt_client, int broker,
+                                const device_table_t *devices, int sensor) {
+  const char *device_id = telemetry_device_id();
+  const char *topic = topics_get(broker, sensor);
+  char object[MAX_SENSOR_ADDRESS_LENGTH];
+
+  if (topic == NULL) {
+    // Not published either
+    return ESP_OK;
+  }
+
+  snprintf(object, sizeof(object), "%016llX", devices->rom[sensor]);
+  int length = snprintf(
+      s_payload, sizeof(s_payload),
+      "{\"name\":\"Temperature %d\", \"unique_id\":\"%s-%s\", "
+      "\"state_topic\":\"%s\", \"value_template\":\"{%% if value_json.idx == "
+      "%d %%}{{ " HOMEASSISTANT_READING_VALUE " }}{%% else %%}{{ this.state "
+      "}}{%% endif %%}\", \"unit_of_measurement\":\"\\u00b0C\", "
+      "\"device_class\":\"temperature\", \"state_class\":\"measurement\", "
+      "\"suggested_display_precision\":2, " HOMEASSISTANT_DEVICE "}",
+      devices->idx[sensor], device_id, object, topic,
+      devices->idx[sensor], device_id, device_id);
+
+  return publish_config(mqtt_client, object, length);
+}
+
+static esp_err_t publish_diagnostic(MQTT_Client *mqtt_client,
+                                    const diagnostic_t *diagnostic) {
+  const char *device_id = telemetry_device_id();
+
+  // The telemetry topic is shared by every device
+  int length = snprintf(
+      s_payload, sizeof(s_payload),
+      "{\"name\":\"%s\", \"unique_id\":\"%s-%s\", \"state_topic\":\"%s\", "
+      "\"value_template\":\"{%% if value_json.device == '%s' %%}{{ "
+      "value_json.%s }}{%% else %%}{{ this.state }}{%% endif %%}\", "
+      "\"unit_of_measurement\":\"%s\", \"device_class\":\"%s\", "
+      "\"state_class\":\"measurement\", \"entity_category\":\"diagnostic\", "
+      HOMEASSISTANT_DEVICE "}",
+      diagnostic->name, device_id, diagnostic->key,
+      CONFIG_ESP_MQTT_TELEMETRY_TOPIC, device_id, diagnostic->value,
+      diagnostic->unit, diagnostic->device_class, device_id, device_id);
+
+  return publish_config(mqtt_client, diagnostic->key, length);
+}
+
+static bool is_configured(const device_table_t *devices, int num_sensors,
+                          uint64_t rom) {
+  for (int i = 0; i < num_sensors; i++) {
+    if (devices->rom[i] == rom) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Removes the entities of the sensors published last time that are no longer
+ * configured, and of the diagnostics once telemetry is disabled.
+ */
+static esp_err_t remove_dropped(MQTT_Client *mqtt_client, int broker,
+                                const device_table_t *devices,
+                                int num_sensors) {
+  char object[MAX_SENSOR_ADDRESS_LENGTH];
+
+  int count = load_roms(broker);
+  for (int i = 0; i < count; i++) {
+    if (!is_configured(devices, num_sensors, s_roms[i])) {
+      snprintf(object, sizeof(object), "%016llX", s_roms[i]);
+      ESP_RETURN_ON_ERROR(publish_retained(mqtt_client, object, ""), TAG,
+                          "Failed to remove sensor %s", object);
+    }
+  }
+
+  for (int i = 0; i < HOMEASSISTANT_DIAGNOSTIC_COUNT &&
+                  strlen(CONFIG_ESP_MQTT_TELEMETRY_TOPIC) == 0;
+       i++) {
+    ESP_RETURN_ON_ERROR(publish_retained(mqtt_client, s_diagnostics[i].key, ""),
+                        TAG, "Failed to remove %s", s_diagnostics[i].key);
+  }
+  return ESP_OK;
+}
+
+esp_err_t homeassistant_publish(MQTT_Client *mqtt_client, int broker,
+                                const mqtt_broker_config_t *config,
+                                const device_table_t *devices,
+                                int num_sensors) {
+  if (broker < 0 || broker >= CONFIG_ESP_MAX_BROKERS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (config->format != MQTT_PAYLOAD_JSON) {
+    // Home Assistant only reads JSON, see tools/cbor_bridge.py
+    return ESP_OK;
+  }
+
+  uint32_t hash = config_hash(config, devices, num_sensors);
+  if (s_published[broker] == 0) {
+    load_hash(broker);
+  }
+  if (s_published[broker] == hash) {
+    return ESP_OK;
+  }
+
+  ESP_LOGI(TAG, "Publishing the Home Assistant discovery to %s",
+           config->host);
+  ESP_RETURN_ON_ERROR(remove_dropped(mqtt_client, broker, devices, num_sensors),
+                      TAG, "Discovery incomplete, retrying next cycle");
+  for (int i = 0; i < num_sensors; i++) {
+    ESP_RETURN_ON_ERROR(publish_sensor(mqtt_client, broker, devices, i), TAG,
+                        "Discovery incomplete, retrying next cycle");
+  }
+
+  // The diagnostics come from the telemetry
+  for (int i = 0; i < HOMEASSISTANT_DIAGNOSTIC_COUNT &&
+                  strlen(CONFIG_ESP_MQTT_TELEMETRY_TOPIC) > 0;
+       i++) {
+    ESP_RETURN_ON_ERROR(publish_diagnostic(mqtt_client, &s_diagnostics[i]),
+                        TAG, "Discovery incomplete, retrying next cycle");
+  }
+
+  return save_hash(broker, hash, devices, num_sensors);
+}
+
+#endif // CONFIG_ESP_HOMEASSISTANT_DISCOVERY
@@ -0,0 +1,44 @@
+#ifndef HOMEASSISTANT_H
+#define HOMEASSISTANT_H
+
+#include <stdint.h>
+
+#include "config_types.h"
+#include "esp_err.h"
+#include "mqtt.h"
+#include "sensor_types.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) &&                                       \
+    defined(CONFIG_ESP_HOMEASSISTANT_DISCOVERY)
+
+#define HOMEASSISTANT_MAX_PAYLOAD_LENGTH 1024 ///< Longest config message
+#define HOMEASSISTANT_SCHEMA 1 ///< Bumped when the config messages change
+
+/**
+ * @brief Publishes the Home Assistant discovery configuration of the device,
+ * if it changed since it was last published to this broker.
+ *
+ * One retained config message is published under
+ * `CONFIG_ESP_HOMEASSISTANT_PREFIX` for each configured sensor, reading its
+ * temperature from the broker topic, and for the RSSI and cycle time
+ * diagnostics, read from the telemetry topic. The messages are summed up by a
+ * hash of what they are built from, kept in RTC memory and NVS per broker, so
+ * they are only published again after the sensors or the topics change. The
+ * sensors published last time and no longer configured get an empty config,
+ * which removes their entity.
+ *
+ * @param mqtt_client a pointer to a connected MQTT_Client.
+ * @param broker position of the broker in the MQTT configuration.
+ * @param config configuration of the broker.
+ * @param devices the table of configured sensors.
+ * @param num_sensors the number of configured sensors.
+ * @return esp_err_t ESP_OK when the configuration is up to date.
+ */
+esp_err_t homeassistant_publish(MQTT_Client *mqtt_client, int broker,
+                                const mqtt_broker_config_t *config,
+                                const device_table_t *devices,
+                                int num_sensors);
+
+#endif // CONFIG_ESP_HOMEASSISTANT_DISCOVERY
+
+#endif // HOMEASSISTANT_H
@@ -2,25 +2,15 @@
 
 #include "esp_log.h"
 
+// Statically allocated, its size is known at build time
+static app_state_t state = {
+    .running = true,
+};
+
 void app_main(void) {
-  app_state_t state = {
-#ifdef CONFIG_ESP_DEBUG_MODE
-      .start_time = {0},
-#endif // CONFIG_ESP_DEBUG_MODE
-      .running = true,
-      .errors = NULL,
-      .num_errors = 0,
-      .onewire_config =
-          {
-              .bus_capacity = 0,
-              .bus_count = 0,
-              .buses = NULL,
-          },
-#ifndef CONFIG_ESP_SCANNER_MODE
-      .sensor_readings = NULL,
-      .num_sensors = 0,
-#endif // CONFIG_ESP_SCANNER_MODE
-  };
+  // Bound the whole wake cycle before anything can block
+  supervisor_init(app_handle_overrun, &state);
+  supervisor_arm();
 
   app_init(&state);
   while (state.running) {
@@ -21,8 +21,22 @@
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 
+#include "command.h"
+#include "pacing.h"
+
 static const char *TAG = "mqtt";
 
+#define MQTT_DATA_QOS CONFIG_ESP_MQTT_READINGS_QOS
+#define MQTT_PACKET_ID_SIZE (MQTT_DATA_QOS > 0 ? 2 : 0)
+#define MQTT_OUTBOX_POLL_MS 10 ///< Delay between two outbox checks
+
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+#define MQTT_TIMESTAMP_LENGTH 21 ///< Longest time_t in decimal
+// Nothing sets the clock, which counts from 1970 at boot unless the
+// application or the bootloader set it. Earlier times are not sent.
+#define MQTT_CLOCK_SET_AFTER 1577836800 ///< 2020-01-01T00:00:00Z
+#endif
+
 static void log_error_if_nonzero(const char *message, int error_code) {
   if (error_code != 0) {
     ESP_LOGE(TAG, "%s: %d", message, error_code);
@@ -34,32 +48,27 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
   ESP_LOGD(TAG,
            "Event dispatched from event loop base=%s, event_id=%" PRIi32 "",
            base, event_id);
+  MQTT_Client *mqtt_client = handler_args;
   esp_mqtt_event_handle_t event = event_data;
-  esp_mqtt_client_handle_t client = event->client;
-  int msg_id;
   switch ((esp_mqtt_event_id_t)event_id) {
   case MQTT_EVENT_CONNECTED:
     ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-    msg_id = esp_mqtt_client_publish(client, "/topic/qos1", "data_3", 0, 1, 0);
-    ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
-
-    msg_id = esp_mqtt_client_subscribe(client, "/topic/qos0", 0);
-    ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-    msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
-    ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
-
-    msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
-    ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+    // Aliases only live as long as the connection
+    mqtt_client->alias_count = 0;
+#endif
+    xEventGroupSetBits(mqtt_client->events, MQTT_CONNECTED_BIT);
+    // The broker sends the retained commands once subscribed
+    command_subscribe(event->client);
     break;
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+    xEventGroupClearBits(mqtt_client->events, MQTT_CONNECTED_BIT);
+    xEventGroupSetBits(mqtt_client->events, MQTT_FAIL_BIT);
     break;
 
   case MQTT_EVENT_SUBSCRIBED:
     ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-    msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-    ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
     break;
   case MQTT_EVENT_UNSUBSCRIBED:
     ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
@@ -68,12 +77,12 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
     ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
     break;
   case MQTT_EVENT_DATA:
-    ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-    printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-    printf("DATA=%.*s\r\n", event->data_len, event->data);
+    ESP_LOGI(TAG, "MQTT_EVENT_DATA on %.*s", event->topic_len, event->topic);
+    command_receive(mqtt_client->commands, event);
     break;
   case MQTT_EVENT_ERROR:
     ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+    xEventGroupSetBits(mqtt_client->events, MQTT_FAIL_BIT);
     if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
       log_error_if_nonzero("reported from esp-tls",
                            event->error_handle->esp_tls_last_esp_err);
@@ -91,32 +100,349 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
   }
 }
 
-esp_err_t mqtt_init(MQTT_Client *mqtt_client, mqtt_broker_config_t *config) {
+/**
+ * Returns the configuration of the client, connecting to the resolved
+ * address. Rebuilt in full whenever it is set, as esp-mqtt resets the fields
+ * left out.
+ */
+static esp_mqtt_client_config_t client_config(MQTT_Client *mqtt_client) {
+  const mqtt_broker_config_t *config = mqtt_client->config;
+  bool use_tls = strcmp(config->protocol, "mqtt") != 0;
   esp_mqtt_client_config_t mqtt_cfg = {
       .broker.address.port = config->port,
-      .broker.address.hostname = config->host,
-      .broker.address.transport = strcmp(config->protocol, "mqtt") == 0
-                                      ? MQTT_TRANSPORT_OVER_TCP
-                                      : MQTT_TRANSPORT_OVER_SSL,
-      .credentials.username = config->username,
-      .credentials.authentication.password = config->password,
+      .broker.address.hostname = mqtt_client->address,
+      .broker.address.transport =
+          use_tls ? MQTT_TRANSPORT_OVER_SSL : MQTT_TRANSPORT_OVER_TCP,
+      // SNI and certificate verification must use the configured hostname,
+      // not the address we connect to
+      .broker.verification.common_name = use_tls ? config->host : NULL,
+      .credentials.username = config->username[0] ? config->username : NULL,
+      .credentials.authentication.password =
+          config->password[0] ? config->password : NULL,
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+      .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
+      // Publishing fails instead of exhausting the heap, 0 for no limit
+      .outbox.limit = CONFIG_ESP_MQTT_OUTBOX_LIMIT,
   };
+  return mqtt_cfg;
+}
+
+esp_err_t mqtt_init(MQTT_Client *mqtt_client, mqtt_broker_config_t *config) {
+  mqtt_client->config = config;
+  mqtt_client->host = config->host;
+
+  // Connect to the cached address to skip the DNS round trip
+  esp_err_t err = dns_cache_resolve(config->host, mqtt_client->address,
+                                    sizeof(mqtt_client->address));
+  if (err != ESP_OK) {
+    return err;
+  }
+
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+  mqtt_client->alias_count = 0;
+  // A reading resent after a reconnection cannot refer to an alias of the
+  // previous connection, so only QoS 0 readings are sent by alias
+  mqtt_client->alias_limit =
+      MQTT_DATA_QOS > 0 ? 0 : CONFIG_ESP_MQTT_TOPIC_ALIASES;
+#endif
+
+  mqtt_client->events = xEventGroupCreate();
+  if (mqtt_client->events == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Stays NULL when commands are disabled
+  mqtt_client->commands = command_queue_create();
+
+  esp_mqtt_client_config_t mqtt_cfg = client_config(mqtt_client);
   mqtt_client->client = esp_mqtt_client_init(&mqtt_cfg);
-  return esp_mqtt_client_register_event(mqtt_client->client, ESP_EVENT_ANY_ID,
-                                        mqtt_event_handler, NULL);
+  if (mqtt_client->client == NULL) {
+    mqtt_stop(mqtt_client);
+    return ESP_FAIL;
+  }
+
+  err = esp_mqtt_client_register_event(mqtt_client->client, ESP_EVENT_ANY_ID,
+                                       mqtt_event_handler, mqtt_client);
+  if (err != ESP_OK) {
+    mqtt_stop(mqtt_client);
+  }
+  return err;
 }
 
 esp_err_t mqtt_start(MQTT_Client *mqtt_client) {
-  return esp_mqtt_client_start(mqtt_client->client);
+  for (int attempt = 0; attempt <= CONFIG_ESP_MQTT_MAX_RETRY; attempt++) {
+    xEventGroupClearBits(mqtt_client->events,
+                         MQTT_CONNECTED_BIT | MQTT_FAIL_BIT);
+
+    esp_err_t err = esp_mqtt_client_start(mqtt_client->client);
+    if (err != ESP_OK) {
+      return err;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(
+        mqtt_client->events, MQTT_CONNECTED_BIT | MQTT_FAIL_BIT, pdFALSE,
+        pdFALSE, pdMS_TO_TICKS(CONFIG_ESP_MQTT_CONNECT_TIMEOUT));
+    if (bits & MQTT_CONNECTED_BIT) {
+      return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "Failed to connect to %s (%s), attempt %d",
+             mqtt_client->host, mqtt_client->address, attempt + 1);
+    esp_mqtt_client_stop(mqtt_client->client);
+
+    // The cached address may be stale, resolve the hostname again
+    dns_cache_invalidate(mqtt_client->host);
+    if (dns_cache_resolve(mqtt_client->host, mqtt_client->address,
+                          sizeof(mqtt_client->address)) == ESP_OK) {
+      esp_mqtt_client_config_t mqtt_cfg = client_config(mqtt_client);
+      esp_mqtt_set_config(mqtt_client->client, &mqtt_cfg);
+    }
+  }
+
+  return ESP_ERR_TIMEOUT;
+}
+
+void mqtt_stop(MQTT_Client *mqtt_client) {
+  if (mqtt_client->client != NULL) {
+    esp_mqtt_client_destroy(mqtt_client->client);
+    mqtt_client->client = NULL;
+  }
+  if (mqtt_client->events != NULL) {
+    vEventGroupDelete(mqtt_client->events);
+    mqtt_client->events = NULL;
+  }
+  if (mqtt_client->commands != NULL) {
+    vQueueDelete(mqtt_client->commands);
+    mqtt_client->commands = NULL;
+  }
+}
+
+bool mqtt_is_connected(MQTT_Client *mqtt_client) {
+  return mqtt_client->client != NULL && mqtt_client->events != NULL &&
+         (xEventGroupGetBits(mqtt_client->events) & MQTT_CONNECTED_BIT);
+}
+
+esp_err_t mqtt_wait_acknowledged(MQTT_Client *mqtt_client) {
+  TickType_t start = xTaskGetTickCount();
+
+  while (esp_mqtt_client_get_outbox_size(mqtt_client->client) > 0) {
+    if (!mqtt_is_connected(mqtt_client)) {
+      return ESP_FAIL;
+    }
+    if (xTaskGetTickCount() - start >=
+        pdMS_TO_TICKS(CONFIG_ESP_MQTT_PUBLISH_WAIT)) {
+      ESP_LOGW(TAG, "%s did not acknowledge every message", mqtt_client->host);
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(pdMS_TO_TICKS(MQTT_OUTBOX_POLL_MS));
+  }
+
+  return ESP_OK;
 }
 
 esp_err_t mqtt_publish(MQTT_Client *mqtt_client, mqtt_broker_config_t *config,
                        const char *data) {
-  if (mqtt_client == NULL || config == NULL || data == NULL) {
+  if (config == NULL || config->topic[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  return mqtt_publish_topic(mqtt_client, config->topic, data);
+}
+
+/**
+ * Waits for the rate limit and the outbox of the broker, see pacing.h.
+ */
+static esp_err_t pace(MQTT_Client *mqtt_client) {
+#ifndef CONFIG_ESP_SCANNER_MODE
+  return pacing_acquire(mqtt_client);
+#else
+  return ESP_OK;
+#endif
+}
+
+static esp_err_t publish_text(MQTT_Client *mqtt_client, const char *topic,
+                              const char *data, int qos, bool retain) {
+  if (mqtt_client == NULL || topic == NULL || data == NULL) {
     return ESP_ERR_INVALID_ARG;
   }
-  int msg_id = esp_mqtt_client_publish(mqtt_client->client, config->topic, data,
-                                       0, 0, 0);
+  esp_err_t err = pace(mqtt_client);
+  if (err != ESP_OK) {
+    return err;
+  }
+  int msg_id =
+      esp_mqtt_client_publish(mqtt_client->client, topic, data, 0, qos, retain);
+  if (msg_id < 0) {
+    ESP_LOGW(TAG, "Failed to publish to %s", topic);
+    return ESP_FAIL;
+  }
   ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
   return ESP_OK;
 }
+
+esp_err_t mqtt_publish_topic(MQTT_Client *mqtt_client, const char *topic,
+                             const char *data) {
+  return publish_text(mqtt_client, topic, data, 0, false);
+}
+
+esp_err_t mqtt_publish_retained(MQTT_Client *mqtt_client, const char *topic,
+                                const char *data) {
+  return publish_text(mqtt_client, topic, data, 1, true);
+}
+
+static uint32_t varint_size(uint32_t value) {
+  // 7 bits per byte
+  uint32_t size = 0;
+  do {
+    size++;
+    value >>= 7;
+  } while (value > 0);
+  return size;
+}
+
+static uint32_t packet_size(uint32_t remaining) {
+  // Packet type, remaining length and the rest of the packet
+  return 1 + varint_size(remaining) + remaining;
+}
+
+uint32_t mqtt_packet_size(const char *topic, size_t length) {
+  // Topic length field, topic, packet id above QoS 0 and message
+  return packet_size(2 + strlen(topic) + MQTT_PACKET_ID_SIZE + length);
+}
+
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+
+/**
+ * Returns the alias of a topic, 0 when it has none. `known` tells whether the
+ * broker learnt it earlier on this connection, otherwise the topic is sent in
+ * full along with the alias.
+ */
+static uint16_t topic_alias(MQTT_Client *mqtt_client, const char *topic,
+                            bool *known) {
+  for (int i = 0; i < mqtt_client->alias_count; i++) {
+    if (mqtt_client->aliases[i] == topic) {
+      *known = true;
+      return i + 1;
+    }
+  }
+
+  *known = false;
+  if (mqtt_client->alias_count < mqtt_client->alias_limit) {
+    return mqtt_client->alias_count + 1;
+  }
+  return 0;
+}
+
+/**
+ * Sets the properties of the next messages. Returns the number of bytes they
+ * take in the packet, or -1 on error.
+ */
+static int set_properties(MQTT_Client *mqtt_client, uint16_t alias,
+                          const mqtt_message_info_t *info) {
+  esp_mqtt5_publish_property_config_t property = {
+      .message_expiry_interval = info != NULL ? info->expiry : 0,
+      .topic_alias = alias,
+  };
+  esp_mqtt5_user_property_item_t items[2];
+  int count = 0;
+  int size = 0;
+
+#ifdef CONFIG_ESP_MQTT_USER_PROPERTIES
+  char timestamp[MQTT_TIMESTAMP_LENGTH];
+  if (info != NULL && info->timestamp >= MQTT_CLOCK_SET_AFTER) {
+    snprintf(timestamp, sizeof(timestamp), "%lld",
+             (long long)info->timestamp);
+    items[count++] = (esp_mqtt5_user_property_item_t){"ts", timestamp};
+  }
+  if (info != NULL && info->quality != NULL) {
+    items[count++] = (esp_mqtt5_user_property_item_t){"quality", info->quality};
+  }
+#endif
+
+  if (count > 0 && esp_mqtt5_client_set_user_property(&property.user_property,
+                                                      items, count) != ESP_OK) {
+    return -1;
+  }
+  esp_err_t err =
+      esp_mqtt5_client_set_publish_property(mqtt_client->client, &property);
+  if (property.user_property != NULL) {
+    // The client keeps a copy
+    esp_mqtt5_client_delete_user_property(property.user_property);
+  }
+  if (err != ESP_OK) {
+    return -1;
+  }
+
+  // Identifier and value of each property
+  size += property.message_expiry_interval > 0 ? 1 + 4 : 0;
+  size += alias > 0 ? 1 + 2 : 0;
+  for (int i = 0; i < count; i++) {
+    size += 1 + 2 + strlen(items[i].key) + 2 + strlen(items[i].value);
+  }
+  return size;
+}
+
+static esp_err_t publish_v5(MQTT_Client *mqtt_client, const char *topic,
+                            const void *data, size_t length, bool retain,
+                            const mqtt_message_info_t *info) {
+  bool known;
+  uint16_t alias = topic_alias(mqtt_client, topic, &known);
+
+  int properties = set_properties(mqtt_client, alias, info);
+  if (properties < 0 && alias > 0 && !known) {
+    // The broker takes fewer aliases, as told in its CONNACK
+    ESP_LOGW(TAG, "%s takes %d topic aliases", mqtt_client->host, alias - 1);
+    mqtt_client->alias_limit = alias - 1;
+    alias = 0;
+    properties = set_properties(mqtt_client, alias, info);
+  }
+  if (properties < 0) {
+    return ESP_FAIL;
+  }
+
+  // Once the broker knows the alias, the topic is sent empty
+  const char *sent_topic = known ? "" : topic;
+  int msg_id = esp_mqtt_client_publish(mqtt_client->client, sent_topic, data,
+                                       length, MQTT_DATA_QOS, retain);
+
+  // The user properties of a client can be replaced but not removed: the
+  // next messages carry their sending time, not the sample time of this one
+  mqtt_message_info_t sending = {.timestamp = time(NULL)};
+  set_properties(mqtt_client, 0, info != NULL ? &sending : NULL);
+
+  if (msg_id < 0) {
+    return ESP_FAIL;
+  }
+  if (alias > 0 && !known) {
+    mqtt_client->aliases[mqtt_client->alias_count++] = topic;
+  }
+
+  ESP_LOGI(TAG, "sent %u bytes, alias %u, msg_id=%d", (unsigned)length,
+           alias, msg_id);
+  mqtt_client->packet_size =
+      packet_size(2 + strlen(sent_topic) + MQTT_PACKET_ID_SIZE +
+                  varint_size(properties) + properties + length);
+  return ESP_OK;
+}
+
+#endif // CONFIG_ESP_MQTT_PROTOCOL_5
+
+esp_err_t mqtt_publish_data(MQTT_Client *mqtt_client, const char *topic,
+                            const void *data, size_t length, bool retain,
+                            const mqtt_message_info_t *info) {
+  if (mqtt_client == NULL || topic == NULL || data == NULL || length == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = pace(mqtt_client);
+  if (err != ESP_OK) {
+    return err;
+  }
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+  return publish_v5(mqtt_client, topic, data, length, retain, info);
+#else
+  int msg_id = esp_mqtt_client_publish(mqtt_client->client, topic, data,
+                                       length, MQTT_DATA_QOS, retain);
+  ESP_LOGI(TAG, "sent %u bytes, msg_id=%d", (unsigned)length, msg_id);
+  mqtt_client->packet_size = mqtt_packet_size(topic, length);
+  return msg_id < 0 ? ESP_FAIL : ESP_OK;
+#endif
+}
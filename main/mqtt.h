@@ -1,9 +1,33 @@
 #ifndef MQTT_H
 #define MQTT_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
 #include "config_types.h"
+#include "dns_cache.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "mqtt_client.h"
 
+/* The event group bits used to follow the connection state of a client */
+#define MQTT_CONNECTED_BIT BIT0
+#define MQTT_FAIL_BIT BIT1
+
+/**
+ * @brief What is known about a message, sent along with it as MQTT 5
+ * properties. Ignored when the brokers are reached with MQTT 3.1.1.
+ */
+typedef struct {
+  time_t timestamp;    ///< When the reading was sampled, 0 if unknown. Not
+                       ///< sent while the clock is not set.
+  const char *quality; ///< Health of the sensor, NULL if unknown
+  uint32_t expiry;     ///< Seconds the message stays relevant, 0 for ever
+} mqtt_message_info_t;
+
 /**
  * @brief MQTT client configuration.
  *
@@ -11,6 +35,19 @@
  */
 typedef struct {
   esp_mqtt_client_handle_t client;
+  EventGroupHandle_t events;             ///< Connection state bits
+  QueueHandle_t commands;                ///< Commands received, see command.h
+  const mqtt_broker_config_t *config;    ///< Configuration of the broker
+  const char *host;                      ///< Broker hostname as configured
+  char address[DNS_CACHE_MAX_IP_LENGTH]; ///< Address the client connects to
+  uint32_t packet_size; ///< Size of the last packet of mqtt_publish_data()
+  int broker;           ///< Position of the broker, for pacing_acquire()
+#ifdef CONFIG_ESP_MQTT_PROTOCOL_5
+  // Topics the broker knows by alias on this connection, alias i + 1 for i
+  const char *aliases[CONFIG_ESP_MQTT_TOPIC_ALIASES];
+  int alias_count; ///< Aliases in use
+  int alias_limit; ///< Aliases the broker accepts, as far as known
+#endif
 } MQTT_Client;
 
 /**
@@ -24,12 +61,35 @@ esp_err_t mqtt_init(MQTT_Client *mqtt_client,
                     mqtt_broker_config_t *mqtt_config);
 
 /**
- * @brief Start the MQTT client.
+ * @brief Start the MQTT client and wait for the connection.
+ *
+ * Waits up to `CONFIG_ESP_MQTT_CONNECT_TIMEOUT` milliseconds per attempt. When
+ * an attempt fails, the cached broker address is dropped and the hostname is
+ * resolved again before retrying, up to `CONFIG_ESP_MQTT_MAX_RETRY` times.
  *
  * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @return esp_err_t ESP_OK once connected, ESP_ERR_TIMEOUT otherwise.
  */
 esp_err_t mqtt_start(MQTT_Client *mqtt_client);
 
+/**
+ * @brief Stop the MQTT client and release its resources.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @return void
+ */
+void mqtt_stop(MQTT_Client *mqtt_client);
+
+/**
+ * @brief Checks whether the client is connected to its broker.
+ *
+ * A client that was never initialized, or was stopped, is not connected.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @return true if the client holds an open session.
+ */
+bool mqtt_is_connected(MQTT_Client *mqtt_client);
+
 /**
  * @brief Publish a message to the MQTT broker.
  *
@@ -41,4 +101,83 @@ esp_err_t mqtt_start(MQTT_Client *mqtt_client);
 esp_err_t mqtt_publish(MQTT_Client *mqtt_client, mqtt_broker_config_t *config,
                        const char *data);
 
+/**
+ * @brief Waits until the broker acknowledged every QoS 1 message in the
+ * outbox of the client, for up to `CONFIG_ESP_MQTT_PUBLISH_WAIT`
+ * milliseconds.
+ *
+ * The outbox is lost when the client is stopped, so a message published at
+ * QoS 1 is only delivered once this returns ESP_OK.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @return esp_err_t ESP_OK once the outbox is empty, ESP_ERR_TIMEOUT if
+ * messages are still waiting, ESP_FAIL if the connection was lost.
+ */
+esp_err_t mqtt_wait_acknowledged(MQTT_Client *mqtt_client);
+
+/**
+ * @brief Publish a message to the given topic of the MQTT broker.
+ *
+ * Like every publish, the message waits for `pacing_acquire()` first.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @param topic the topic to publish to.
+ * @param data the message to publish.
+ * @return esp_err_t Error code indicating success or failure, ESP_ERR_TIMEOUT
+ * if the broker is congested.
+ */
+esp_err_t mqtt_publish_topic(MQTT_Client *mqtt_client, const char *topic,
+                             const char *data);
+
+/**
+ * @brief Publish a retained message to the given topic of the MQTT broker, at
+ * QoS 1. An empty message clears the retained one.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @param topic the topic to publish to.
+ * @param data the message to publish.
+ * @return esp_err_t Error code indicating success or failure, ESP_ERR_TIMEOUT
+ * if the broker is congested.
+ */
+esp_err_t mqtt_publish_retained(MQTT_Client *mqtt_client, const char *topic,
+                                const char *data);
+
+/**
+ * @brief Publish a message of the given length to the given topic of the MQTT
+ * broker. The message may be binary.
+ *
+ * With `CONFIG_ESP_MQTT_PROTOCOL_5`, the topic is given an alias the first
+ * time it is published on a connection and is sent as that alias afterwards,
+ * so the topic must stay at the same address for the life of the client. The
+ * message carries the expiry interval of `info`, and its timestamp and quality
+ * as the `ts` and `quality` user properties, `ts` only once the clock is set.
+ * The size of the packet sent is left in `packet_size`.
+ *
+ * The message is published at `CONFIG_ESP_MQTT_READINGS_QOS`. At QoS 1 it
+ * stays in the outbox until the broker acknowledges it, see
+ * `mqtt_wait_acknowledged()`, and the topic is always sent in full.
+ *
+ * @param mqtt_client a pointer to the MQTT_Client struct.
+ * @param topic the topic to publish to.
+ * @param data the message to publish.
+ * @param length the length of the message, in bytes.
+ * @param retain whether the broker keeps the message for new subscribers.
+ * @param info what is known about the message, or NULL.
+ * @return esp_err_t Error code indicating success or failure, ESP_ERR_TIMEOUT
+ * if the broker is congested.
+ */
+esp_err_t mqtt_publish_data(MQTT_Client *mqtt_client, const char *topic,
+                            const void *data, size_t length, bool retain,
+                            const mqtt_message_info_t *info);
+
+/**
+ * @brief Returns the size of the MQTT 3.1.1 PUBLISH packet of a message
+ * published with `mqtt_publish_data()`, topic and header included.
+ *
+ * @param topic the topic of the message.
+ * @param length the length of the message.
+ * @return uint32_t the packet size, in bytes.
+ */
+uint32_t mqtt_packet_size(const char *topic, size_t length);
+
 #endif // MQTT_H
@@ -0,0 +1,50 @@
+#include "oversampling.h"
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) && defined(CONFIG_ESP_OVERSAMPLING)
+
+static void sort_samples(int16_t *samples, int count) {
+  // Insertion sort, bursts are a handful of samples
+  for (int i = 1; i < count; i++) {
+    int16_t value = samples[i];
+    int j = i - 1;
+    while (j >= 0 && samples[j] > value) {
+      samples[j + 1] = samples[j];
+      j--;
+    }
+    samples[j + 1] = value;
+  }
+}
+
+/**
+ * Divides rounding half away from zero.
+ */
+static int32_t divide_rounded(int32_t value, int32_t divisor) {
+  return value >= 0 ? (value + divisor / 2) / divisor
+                    : (value - divisor / 2) / divisor;
+}
+
+int16_t oversampling_reduce(int16_t *samples, int count, uint16_t *spread) {
+  sort_samples(samples, count);
+  *spread = samples[count - 1] - samples[0];
+
+#ifdef CONFIG_ESP_OVERSAMPLING_MEDIAN
+  if (count % 2 == 1) {
+    return samples[count / 2];
+  }
+  return divide_rounded(samples[count / 2 - 1] + samples[count / 2], 2);
+#else
+  int trim = CONFIG_ESP_OVERSAMPLING_TRIM;
+  if (count - 2 * trim < 1) {
+    // Fewer samples than expected came back, keep at least the middle one
+    trim = (count - 1) / 2;
+  }
+
+  int32_t sum = 0;
+  for (int i = trim; i < count - trim; i++) {
+    sum += samples[i];
+  }
+  return divide_rounded(sum, count - 2 * trim);
+#endif
+}
+
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_OVERSAMPLING
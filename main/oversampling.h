@@ -0,0 +1,24 @@
+#ifndef OVERSAMPLING_H
+#define OVERSAMPLING_H
+
+#include <stdint.h>
+
+#if !defined(CONFIG_ESP_SCANNER_MODE) && defined(CONFIG_ESP_OVERSAMPLING)
+
+/**
+ * @brief Reduces a burst of conversions to a single temperature.
+ *
+ * Uses the median or the trimmed mean, as selected by
+ * `CONFIG_ESP_OVERSAMPLING_FILTER`. Only integer arithmetic is used.
+ *
+ * @param samples The conversions, in sixteenths of a degree. Sorted in place.
+ * @param count The number of conversions, at least 1.
+ * @param spread Receives the difference between the highest and the lowest
+ * conversion, in sixteenths of a degree.
+ * @return int16_t The temperature, in sixteenths of a degree.
+ */
+int16_t oversampling_reduce(int16_t *samples, int count, uint16_t *spread);
+
+#endif // !CONFIG_ESP_SCANNER_MODE && CONFIG_ESP_OVERSAMPLING
+
+#endif // OVERSAMPLING_H
@@ -0,0 +1,132 @@
+#include "pacing.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+static const char *TAG = "pacing";
+
+#define PACING_OUTBOX_POLL_US 10000 ///< Delay between two outbox checks
+
+#if CONFIG_ESP_MQTT_PUBLISH_RATE > 0
+#define PACING_TOKEN_US (1000000 / CONFIG_ESP_MQTT_PUBLISH_RATE)
+#define PACING_BUCKET_US                                                       \
+  ((int64_t)PACING_TOKEN_US * CONFIG_ESP_MQTT_PUBLISH_BURST)
+#endif
+
+/**
+ * @brief The token bucket of a broker.
+ *
+ * Tokens are counted as the time they took to refill, in microseconds.
+ */
+typedef struct {
+  int64_t credit_us;  ///< Refilled time, one token per PACING_TOKEN_US
+  int64_t updated_us; ///< When the credit was last refilled, 0 at boot
+  bool congested;     ///< Gave up waiting in this cycle
+} pacing_bucket_t;
+
+static pacing_bucket_t s_buckets[CONFIG_ESP_MAX_BROKERS];
+
+RTC_DATA_ATTR static pacing_stats_t s_cycle;
+RTC_DATA_ATTR static pacing_stats_t s_last;
+
+/**
+ * Returns how long to wait for outbox space, 0 when there is some.
+ */
+static int64_t outbox_wait(MQTT_Client *mqtt_client) {
+#if CONFIG_ESP_MQTT_OUTBOX_LIMIT > 0
+  int size = esp_mqtt_client_get_outbox_size(mqtt_client->client);
+  if (size >= CONFIG_ESP_MQTT_OUTBOX_LIMIT) {
+    return PACING_OUTBOX_POLL_US;
+  }
+#endif
+  return 0;
+}
+
+/**
+ * Takes a token and returns 0, or returns how long to wait for one.
+ */
+static int64_t token_wait(pacing_bucket_t *bucket, int64_t now) {
+#if CONFIG_ESP_MQTT_PUBLISH_RATE > 0
+  if (bucket->updated_us == 0) {
+    // Full after boot, the device slept long enough
+    bucket->credit_us = PACING_BUCKET_US;
+  } else {
+    bucket->credit_us += now - bucket->updated_us;
+    if (bucket->credit_us > PACING_BUCKET_US) {
+      bucket->credit_us = PACING_BUCKET_US;
+    }
+  }
+  bucket->updated_us = now;
+
+  if (bucket->credit_us < PACING_TOKEN_US) {
+    return PACING_TOKEN_US - bucket->credit_us;
+  }
+  bucket->credit_us -= PACING_TOKEN_US;
+#endif
+  return 0;
+}
+
+void pacing_begin(int broker) {
+  if (broker >= 0 && broker < CONFIG_ESP_MAX_BROKERS) {
+    s_buckets[broker].congested = false;
+  }
+}
+
+esp_err_t pacing_acquire(MQTT_Client *mqtt_client) {
+  int broker = mqtt_client->broker;
+  if (broker < 0 || broker >= CONFIG_ESP_MAX_BROKERS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  pacing_bucket_t *bucket = &s_buckets[broker];
+  if (bucket->congested) {
+    return ESP_ERR_TIMEOUT;
+  }
+
+  int64_t start = esp_timer_get_time();
+  int64_t deadline = start + CONFIG_ESP_MQTT_PUBLISH_WAIT * 1000LL;
+  int64_t now = start;
+  for (;;) {
+    // The token is only taken once the outbox has room for the message
+    int64_t wait_us = outbox_wait(mqtt_client);
+    if (wait_us == 0) {
+      wait_us = token_wait(bucket, now);
+    }
+    if (wait_us == 0) {
+      break;
+    }
+
+    if (now + wait_us > deadline) {
+      ESP_LOGW(TAG, "%s congested, deferring its messages",
+               mqtt_client->host);
+      bucket->congested = true;
+      s_cycle.wait_ms += (now - start) / 1000;
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(pdMS_TO_TICKS(wait_us / 1000) + 1);
+    now = esp_timer_get_time();
+  }
+
+  s_cycle.wait_ms += (now - start) / 1000;
+  return ESP_OK;
+}
+
+void pacing_count_deferred(uint32_t count) { s_cycle.deferred += count; }
+
+void pacing_count_dropped(uint32_t count) { s_cycle.dropped += count; }
+
+void pacing_begin_cycle(void) {
+  s_last = s_cycle;
+  memset(&s_cycle, 0, sizeof(s_cycle));
+}
+
+const pacing_stats_t *pacing_get_stats(void) { return &s_last; }
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,83 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief What the pacing of the reading messages cost in a cycle.
+ */
+typedef struct {
+  uint32_t deferred; ///< Readings kept for the next cycle after a broker
+                     ///< stayed congested or refused them
+  uint32_t dropped;  ///< Readings lost out of a full backlog, or when the
+                     ///< set of sensors changed
+  uint32_t wait_ms;  ///< Time spent waiting for a token or outbox space
+} pacing_stats_t;
+
+/**
+ * @brief Starts publishing the messages of a cycle to a broker.
+ *
+ * A broker found congested in a previous cycle is given a new chance.
+ *
+ * @param broker position of the broker in the MQTT configuration.
+ * @return void
+ */
+void pacing_begin(int broker);
+
+/**
+ * @brief Waits until a message may be published to the broker of a client.
+ *
+ * Every publish of `mqtt.h` calls it first. The message must wait for a token
+ * of the broker, refilled at
+ * `CONFIG_ESP_MQTT_PUBLISH_RATE` messages per second up to
+ * `CONFIG_ESP_MQTT_PUBLISH_BURST`, and for the outbox of the client to fall
+ * under `CONFIG_ESP_MQTT_OUTBOX_LIMIT` bytes, held by the QoS 1 messages the
+ * broker has not acknowledged yet. When that takes longer than
+ * `CONFIG_ESP_MQTT_PUBLISH_WAIT` milliseconds, the broker is congested: this
+ * message and the next ones fail at once until `pacing_begin()`.
+ *
+ * @param mqtt_client a pointer to the connected MQTT_Client of the broker.
+ * @return esp_err_t ESP_OK once the message may be published, ESP_ERR_TIMEOUT
+ * if the broker is congested.
+ */
+esp_err_t pacing_acquire(MQTT_Client *mqtt_client);
+
+/**
+ * @brief Counts readings kept for the next cycle in the statistics.
+ *
+ * @param count the number of readings.
+ * @return void
+ */
+void pacing_count_deferred(uint32_t count);
+
+/**
+ * @brief Counts lost readings in the statistics.
+ *
+ * @param count the number of readings.
+ * @return void
+ */
+void pacing_count_dropped(uint32_t count);
+
+/**
+ * @brief Starts the statistics of a new cycle. Those of the cycle that ends
+ * become the ones returned by `pacing_get_stats()`.
+ *
+ * @return void
+ */
+void pacing_begin_cycle(void);
+
+/**
+ * @brief Returns the statistics of the last complete cycle.
+ *
+ * @return const pacing_stats_t* The statistics, kept in RTC memory.
+ */
+const pacing_stats_t *pacing_get_stats(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // PACING_H
@@ -0,0 +1,131 @@
+#include "payload.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "supervisor.h"
+#include "telemetry.h"
+#include "wifi.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/* CBOR major types, RFC 8949 */
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_INDEFINITE_ARRAY 0x9F
+#define CBOR_BREAK 0xFF
+
+#define PAYLOAD_READING_FIELDS 5 ///< ROM, idx, temperature, resolution, spread
+#define PAYLOAD_MAX_READING_LENGTH 24 ///< Longest encoded reading
+
+RTC_DATA_ATTR static payload_stats_t s_cycle;
+RTC_DATA_ATTR static payload_stats_t s_last;
+
+static void put_head(payload_cbor_t *message, int major, uint64_t value) {
+  uint8_t *out = message->data + message->length;
+  int size;
+
+  if (value < 24) {
+    out[0] = major << 5 | value;
+    message->length += 1;
+    return;
+  } else if (value <= UINT8_MAX) {
+    out[0] = major << 5 | 24;
+    size = 1;
+  } else if (value <= UINT16_MAX) {
+    out[0] = major << 5 | 25;
+    size = 2;
+  } else if (value <= UINT32_MAX) {
+    out[0] = major << 5 | 26;
+    size = 4;
+  } else {
+    out[0] = major << 5 | 27;
+    size = 8;
+  }
+
+  // Big-endian argument
+  for (int i = 0; i < size; i++) {
+    out[1 + i] = value >> (8 * (size - 1 - i));
+  }
+  message->length += 1 + size;
+}
+
+static void put_int(payload_cbor_t *message, int64_t value) {
+  if (value >= 0) {
+    put_head(message, CBOR_UNSIGNED, value);
+  } else {
+    put_head(message, CBOR_NEGATIVE, -1 - value);
+  }
+}
+
+static void put_text(payload_cbor_t *message, const char *text) {
+  size_t length = strlen(text);
+  put_head(message, CBOR_TEXT, length);
+  memcpy(message->data + message->length, text, length);
+  message->length += length;
+}
+
+void payload_cbor_begin(payload_cbor_t *message) {
+  message->length = 0;
+  message->count = 0;
+  message->json_bytes = 0;
+
+  put_head(message, CBOR_MAP, 4);
+  put_int(message, PAYLOAD_KEY_DEVICE);
+  put_text(message, telemetry_device_id());
+  put_int(message, PAYLOAD_KEY_CYCLE);
+  put_int(message, supervisor_get_stats()->cycles);
+  put_int(message, PAYLOAD_KEY_RSSI);
+  put_int(message, wifi_get_stats()->rssi);
+  put_int(message, PAYLOAD_KEY_READINGS);
+  message->data[message->length++] = CBOR_INDEFINITE_ARRAY;
+}
+
+bool payload_cbor_add(payload_cbor_t *message, uint64_t rom,
+                      const sensor_reading_t *reading, uint32_t json_bytes) {
+  // Room for the longest reading and the final break
+  if (message->count >= PAYLOAD_CBOR_MAX_READINGS ||
+      message->length + PAYLOAD_MAX_READING_LENGTH + 1 >
+          sizeof(message->data)) {
+    return false;
+  }
+
+  put_head(message, CBOR_ARRAY, PAYLOAD_READING_FIELDS);
+  put_head(message, CBOR_UNSIGNED, rom);
+  put_int(message, reading->idx);
+  put_int(message, lroundf(reading->temperature * 100));
+  put_int(message, reading->resolution);
+  put_int(message, reading->spread);
+
+  message->count++;
+  message->json_bytes += json_bytes;
+  return true;
+}
+
+size_t payload_cbor_end(payload_cbor_t *message) {
+  if (message->count == 0) {
+    return 0;
+  }
+  message->data[message->length++] = CBOR_BREAK;
+  return message->length;
+}
+
+void payload_count(uint32_t bytes, uint32_t json_bytes) {
+  s_cycle.messages++;
+  s_cycle.bytes += bytes;
+  s_cycle.json_bytes += json_bytes;
+}
+
+void payload_begin_cycle(void) {
+  s_last = s_cycle;
+  memset(&s_cycle, 0, sizeof(s_cycle));
+}
+
+const payload_stats_t *payload_get_stats(void) { return &s_last; }
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,105 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+#define PAYLOAD_CBOR_MAX_LENGTH 1024 ///< Longest CBOR message
+#define PAYLOAD_CBOR_MAX_READINGS 64 ///< Most readings in a CBOR message
+
+/* Keys of the CBOR cycle message */
+#define PAYLOAD_KEY_DEVICE 0   ///< Device identifier, text
+#define PAYLOAD_KEY_CYCLE 1    ///< Cycles since power-on, unsigned
+#define PAYLOAD_KEY_RSSI 2     ///< RSSI of the access point in dBm, integer
+#define PAYLOAD_KEY_READINGS 3 ///< Readings, indefinite-length array
+
+/**
+ * @brief A CBOR message holding the readings of a cycle.
+ *
+ * The message is a map of small integer keys (`PAYLOAD_KEY_*`) to the device
+ * metadata and to an indefinite-length array of readings. Each reading is an
+ * array of the ROM code, the idx, the temperature in hundredths of a degree,
+ * the resolution in bits and the oversampling spread in sixteenths of a
+ * degree. The reference decoder is `tools/cbor_bridge.py`.
+ */
+typedef struct {
+  uint8_t data[PAYLOAD_CBOR_MAX_LENGTH];
+  size_t length;       ///< Bytes used in `data`
+  int count;           ///< Readings in the message
+  uint32_t json_bytes; ///< Packet size of the same readings as JSON
+} payload_cbor_t;
+
+/**
+ * @brief Sizes of the reading messages published in a cycle.
+ *
+ * Sizes are those of the MQTT PUBLISH packets, topic and header included.
+ */
+typedef struct {
+  uint32_t messages;   ///< Messages published
+  uint32_t bytes;      ///< Bytes published, as configured
+  uint32_t json_bytes; ///< Bytes the readings take as MQTT 3.1.1 JSON
+} payload_stats_t;
+
+/**
+ * @brief Starts a CBOR message with the device metadata.
+ *
+ * @param message the message to start.
+ * @return void
+ */
+void payload_cbor_begin(payload_cbor_t *message);
+
+/**
+ * @brief Adds a reading to a CBOR message.
+ *
+ * @param message the started message.
+ * @param rom ROM code of the sensor.
+ * @param reading the reading.
+ * @param json_bytes packet size of the JSON message of the reading, for the
+ * statistics.
+ * @return true if the reading was added, false if the message is full and
+ * must be published first.
+ */
+bool payload_cbor_add(payload_cbor_t *message, uint64_t rom,
+                      const sensor_reading_t *reading, uint32_t json_bytes);
+
+/**
+ * @brief Terminates a CBOR message.
+ *
+ * @param message the message to terminate.
+ * @return size_t the length of the message, 0 if it holds no reading.
+ */
+size_t payload_cbor_end(payload_cbor_t *message);
+
+/**
+ * @brief Counts a published reading message in the statistics of the cycle.
+ *
+ * @param bytes size of the packet sent, see `mqtt_publish_data()`.
+ * @param json_bytes packet size of the same readings as JSON messages with
+ * their full topic, see `mqtt_packet_size()`.
+ * @return void
+ */
+void payload_count(uint32_t bytes, uint32_t json_bytes);
+
+/**
+ * @brief Starts the statistics of a new cycle. Those of the cycle that ends
+ * become the ones returned by `payload_get_stats()`.
+ *
+ * @return void
+ */
+void payload_begin_cycle(void);
+
+/**
+ * @brief Returns the statistics of the last complete cycle.
+ *
+ * @return const payload_stats_t* The statistics, kept in RTC memory.
+ */
+const payload_stats_t *payload_get_stats(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // PAYLOAD_H
@@ -0,0 +1,78 @@
+#include "pipeline.h"
+
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#if defined(CONFIG_ESP_PIPELINE) && !defined(CONFIG_ESP_SCANNER_MODE)
+
+static const char *TAG = "pipeline";
+
+static pipeline_entry_t s_ring[CONFIG_ESP_MAX_SENSORS];
+
+// Free-running counters, reset every cycle before they can wrap. The head is
+// written by the producer only, the tail by the consumer only.
+static atomic_uint s_head = 0;
+static atomic_uint s_tail = 0;
+static atomic_bool s_closed = false;
+static TaskHandle_t s_consumer = NULL;
+
+void pipeline_reset(void) {
+  atomic_store(&s_head, 0);
+  atomic_store(&s_tail, 0);
+  atomic_store(&s_closed, false);
+  s_consumer = xTaskGetCurrentTaskHandle();
+
+  // Drop a wake-up left over from the previous cycle
+  ulTaskNotifyTake(pdTRUE, 0);
+}
+
+bool pipeline_push(uint16_t sensor, const sensor_reading_t *reading) {
+  unsigned head = atomic_load_explicit(&s_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&s_tail, memory_order_acquire);
+
+  if (head - tail >= CONFIG_ESP_MAX_SENSORS) {
+    ESP_LOGE(TAG, "Ring full, reading of sensor %d not queued", reading->idx);
+    return false;
+  }
+
+  s_ring[head % CONFIG_ESP_MAX_SENSORS] = (pipeline_entry_t){
+      .sensor = sensor,
+      .reading = *reading,
+  };
+  atomic_store_explicit(&s_head, head + 1, memory_order_release);
+
+  xTaskNotifyGive(s_consumer);
+  return true;
+}
+
+void pipeline_close(void) {
+  atomic_store_explicit(&s_closed, true, memory_order_release);
+  xTaskNotifyGive(s_consumer);
+}
+
+bool pipeline_pop(pipeline_entry_t *entry) {
+  unsigned tail = atomic_load_explicit(&s_tail, memory_order_relaxed);
+
+  for (;;) {
+    // Read before the head, a push racing with the close is not lost
+    bool closed = atomic_load_explicit(&s_closed, memory_order_acquire);
+
+    if (tail != atomic_load_explicit(&s_head, memory_order_acquire)) {
+      *entry = s_ring[tail % CONFIG_ESP_MAX_SENSORS];
+      atomic_store_explicit(&s_tail, tail + 1, memory_order_release);
+      return true;
+    }
+
+    if (closed) {
+      return false;
+    }
+
+    // Every push and the close give a notification, none is missed
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+#endif // CONFIG_ESP_PIPELINE && !CONFIG_ESP_SCANNER_MODE
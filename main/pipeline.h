@@ -0,0 +1,69 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "sensor_types.h"
+
+#if defined(CONFIG_ESP_PIPELINE) && !defined(CONFIG_ESP_SCANNER_MODE)
+
+#define PIPELINE_ACQUISITION_CORE APP_CPU_NUM ///< WiFi runs on the other core
+#define PIPELINE_ACQUISITION_STACK_SIZE 4096
+
+/**
+ * @brief A reading handed from the acquisition task to the network task.
+ */
+typedef struct {
+  uint16_t sensor;          ///< Flat id of the sensor
+  sensor_reading_t reading; ///< The reading itself
+} pipeline_entry_t;
+
+/**
+ * @brief Empties the ring and makes the calling task its consumer.
+ *
+ * Must be called before the producer starts. The ring holds
+ * `CONFIG_ESP_MAX_SENSORS` entries, one cycle never fills it.
+ *
+ * @return void
+ */
+void pipeline_reset(void);
+
+/**
+ * @brief Queues a reading. Producer side only.
+ *
+ * Does not block nor take a lock: the entry is copied into the ring and
+ * published to the consumer by a release store of the head index.
+ *
+ * @param sensor Flat id of the sensor.
+ * @param reading The reading to queue.
+ * @return true if the reading was queued, false if the ring is full.
+ */
+bool pipeline_push(uint16_t sensor, const sensor_reading_t *reading);
+
+/**
+ * @brief Tells the consumer that no more readings are coming this cycle.
+ * Producer side only, its last call on the ring.
+ *
+ * Every write of the producer before this call is visible to the consumer
+ * once `pipeline_pop()` returned false.
+ *
+ * @return void
+ */
+void pipeline_close(void);
+
+/**
+ * @brief Takes the oldest queued reading. Consumer side only.
+ *
+ * Blocks until a reading is queued or the ring is closed.
+ *
+ * @param entry Where to copy the reading.
+ * @return true if a reading was taken, false once the ring is closed and
+ * drained.
+ */
+bool pipeline_pop(pipeline_entry_t *entry);
+
+#endif // CONFIG_ESP_PIPELINE && !CONFIG_ESP_SCANNER_MODE
+
+#endif // PIPELINE_H
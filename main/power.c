@@ -0,0 +1,105 @@
+#include "power.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+
+static const char *TAG = "power";
+
+#define POWER_MIN_FREQ_MHZ 40 ///< XTAL frequency, the radio needs no less
+
+static const bool s_needs_max_freq[SUPERVISOR_PHASE_COUNT] = {
+    [SUPERVISOR_PHASE_ACQUISITION] = false,
+    [SUPERVISOR_PHASE_CONNECT] = true,
+    [SUPERVISOR_PHASE_PUBLISH] = true,
+};
+
+RTC_DATA_ATTR static power_stats_t s_last = {0};
+RTC_DATA_ATTR static power_stats_t s_current = {0};
+
+static esp_pm_lock_handle_t s_max_freq_lock = NULL;
+static supervisor_phase_t s_phase = SUPERVISOR_PHASE_NONE;
+static int64_t s_phase_start_us = 0;
+
+esp_err_t power_init(void) {
+  const esp_pm_config_t config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+#ifdef CONFIG_ESP_LIGHT_SLEEP
+      .light_sleep_enable = true,
+#endif
+  };
+
+  ESP_RETURN_ON_ERROR(esp_pm_configure(&config), TAG,
+                      "Failed to configure power management");
+  ESP_RETURN_ON_ERROR(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "phase",
+                                         &s_max_freq_lock),
+                      TAG, "Failed to create the phase lock");
+
+  ESP_LOGI(TAG, "CPU frequency scaled between %d and %d MHz%s",
+           POWER_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+#ifdef CONFIG_ESP_LIGHT_SLEEP
+           ", automatic light sleep enabled"
+#else
+           ""
+#endif
+  );
+
+  return ESP_OK;
+}
+
+void power_begin_cycle(void) {
+  power_end_phase();
+  s_last = s_current;
+  memset(&s_current, 0, sizeof(s_current));
+}
+
+void power_begin_phase(supervisor_phase_t phase) {
+  power_end_phase();
+
+  if (phase >= SUPERVISOR_PHASE_COUNT) {
+    return;
+  }
+
+  s_phase = phase;
+  s_phase_start_us = esp_timer_get_time();
+  if (s_needs_max_freq[phase] && s_max_freq_lock != NULL) {
+    esp_pm_lock_acquire(s_max_freq_lock);
+  }
+}
+
+void power_end_phase(void) {
+  if (s_phase == SUPERVISOR_PHASE_NONE) {
+    return;
+  }
+
+  uint32_t elapsed_ms =
+      (uint32_t)((esp_timer_get_time() - s_phase_start_us) / 1000);
+  power_phase_stats_t *stats = &s_current.phases[s_phase];
+  stats->ms += elapsed_ms;
+  if (s_needs_max_freq[s_phase] && s_max_freq_lock != NULL) {
+    esp_pm_lock_release(s_max_freq_lock);
+    stats->max_freq_ms += elapsed_ms;
+  }
+
+  s_phase = SUPERVISOR_PHASE_NONE;
+}
+
+const power_stats_t *power_get_stats(void) { return &s_last; }
+
+float power_estimate_charge_uah(const power_phase_stats_t *phase) {
+  // mA x ms / 3600 gives uAh
+  uint32_t min_freq_ms = phase->ms - phase->max_freq_ms;
+  return (phase->max_freq_ms * (float)CONFIG_ESP_POWER_CURRENT_MAX_FREQ +
+          min_freq_ms * (float)CONFIG_ESP_POWER_CURRENT_MIN_FREQ) /
+         3600.0f;
+}
+
+#endif // CONFIG_ESP_DYNAMIC_FREQUENCY
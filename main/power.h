@@ -0,0 +1,91 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "supervisor.h"
+
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+
+/**
+ * @brief Time spent in a phase during one cycle.
+ */
+typedef struct {
+  uint32_t ms;          ///< Total time spent in the phase
+  uint32_t max_freq_ms; ///< Part of it at the maximum CPU frequency
+} power_phase_stats_t;
+
+/**
+ * @brief Per-phase time of the last completed cycle, kept in RTC memory.
+ */
+typedef struct {
+  power_phase_stats_t phases[SUPERVISOR_PHASE_COUNT]; ///< Indexed by phase
+} power_stats_t;
+
+/**
+ * @brief Enables dynamic frequency scaling and creates the phase lock.
+ *
+ * Once enabled, the CPU runs at the minimum frequency unless a driver, or a
+ * phase that needs it, holds a power management lock. With
+ * `CONFIG_ESP_LIGHT_SLEEP`, the chip also enters light sleep whenever every
+ * task is blocked. The wake timer is then set by tickless idle from the next
+ * FreeRTOS timeout, so a task delay is enough to sleep until the next
+ * reading.
+ *
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t power_init(void);
+
+/**
+ * @brief Starts a new cycle.
+ *
+ * The time recorded so far becomes the last completed cycle, as returned by
+ * `power_get_stats()`.
+ *
+ * @return void
+ */
+void power_begin_cycle(void);
+
+/**
+ * @brief Enters a phase, raising the CPU to its maximum frequency when the
+ * phase is CPU bound.
+ *
+ * WiFi bring-up, TLS handshakes and payload serialization (the connect and
+ * publish phases) run at the maximum frequency. Acquisition is mostly spent
+ * waiting for conversions and stays at the minimum frequency.
+ *
+ * @param phase The phase being entered.
+ * @return void
+ */
+void power_begin_phase(supervisor_phase_t phase);
+
+/**
+ * @brief Leaves the current phase and releases its lock, if any.
+ *
+ * @return void
+ */
+void power_end_phase(void);
+
+/**
+ * @brief Returns the per-phase time of the last completed cycle.
+ *
+ * @return const power_stats_t* The statistics.
+ */
+const power_stats_t *power_get_stats(void);
+
+/**
+ * @brief Estimates the charge drawn by the CPU during a phase.
+ *
+ * The estimate uses `CONFIG_ESP_POWER_CURRENT_MAX_FREQ` and
+ * `CONFIG_ESP_POWER_CURRENT_MIN_FREQ` and leaves the radio out.
+ *
+ * @param phase The time spent in the phase.
+ * @return float The charge in microampere-hours.
+ */
+float power_estimate_charge_uah(const power_phase_stats_t *phase);
+
+#endif // CONFIG_ESP_DYNAMIC_FREQUENCY
+
+#endif // POWER_H
@@ -0,0 +1,164 @@
+#include "resolution.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "sensor.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+static const char *TAG = "resolution";
+
+#define RESOLUTION_NVS_NAMESPACE "resolution"
+#define RESOLUTION_NVS_KEY "verified"
+
+static resolution_cache_entry_t s_cache[CONFIG_ESP_MAX_SENSORS];
+static int s_count = 0;
+static bool s_dirty = false;
+
+static resolution_cache_entry_t *find_entry(uint64_t address) {
+  for (int i = 0; i < s_count; i++) {
+    if (s_cache[i].address == address) {
+      return &s_cache[i];
+    }
+  }
+  return NULL;
+}
+
+static void store_entry(uint64_t address, int resolution) {
+  resolution_cache_entry_t *entry = find_entry(address);
+  if (entry == NULL) {
+    if (s_count < CONFIG_ESP_MAX_SENSORS) {
+      entry = &s_cache[s_count++];
+    } else {
+      // Full of sensors that are no longer configured, start over
+      s_count = 0;
+      entry = &s_cache[s_count++];
+    }
+  }
+
+  entry->address = address;
+  entry->resolution = resolution;
+  s_dirty = true;
+}
+
+/**
+ * Programs the EEPROM of a sensor with the given resolution, unless it
+ * already holds it.
+ */
+static esp_err_t program_eeprom(const onewire_device_t *device,
+                                int resolution) {
+  uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+
+  // The scratchpad may hold a resolution that was never copied, reload it
+  ESP_RETURN_ON_ERROR(sensor_recall_eeprom(device), TAG,
+                      "Failed to recall EEPROM of %016llX", device->address);
+  ESP_RETURN_ON_ERROR(sensor_read_scratchpad(device, scratchpad), TAG,
+                      "Failed to read scratchpad of %016llX", device->address);
+
+  int current = config_to_resolution(scratchpad[DS18B20_SCRATCHPAD_CONFIG]);
+  if (current == resolution) {
+    ESP_LOGD(TAG, "Sensor %016llX already at %d bits", device->address,
+             resolution);
+    return ESP_OK;
+  }
+
+  ESP_LOGI(TAG, "Programming sensor %016llX from %d to %d bits",
+           device->address, current, resolution);
+
+  ESP_RETURN_ON_ERROR(
+      sensor_write_scratchpad(device, scratchpad[DS18B20_SCRATCHPAD_TH],
+                              scratchpad[DS18B20_SCRATCHPAD_TL],
+                              resolution_to_config(resolution)),
+      TAG, "Failed to write scratchpad of %016llX", device->address);
+  ESP_RETURN_ON_ERROR(sensor_copy_scratchpad(device), TAG,
+                      "Failed to copy scratchpad of %016llX", device->address);
+
+  // Read the EEPROM back through the scratchpad
+  ESP_RETURN_ON_ERROR(sensor_recall_eeprom(device), TAG,
+                      "Failed to recall EEPROM of %016llX", device->address);
+  ESP_RETURN_ON_ERROR(sensor_read_scratchpad(device, scratchpad), TAG,
+                      "Failed to read scratchpad of %016llX", device->address);
+
+  current = config_to_resolution(scratchpad[DS18B20_SCRATCHPAD_CONFIG]);
+  if (current != resolution) {
+    ESP_LOGE(TAG, "Sensor %016llX EEPROM holds %d bits after programming %d",
+             device->address, current, resolution);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+
+  return ESP_OK;
+}
+
+void resolution_init(void) {
+  nvs_handle_t handle;
+  s_count = 0;
+  s_dirty = false;
+
+  if (nvs_open(RESOLUTION_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    ESP_LOGD(TAG, "No verified resolutions stored");
+    return;
+  }
+
+  size_t size = sizeof(s_cache);
+  esp_err_t err = nvs_get_blob(handle, RESOLUTION_NVS_KEY, s_cache, &size);
+  nvs_close(handle);
+
+  if (err != ESP_OK || size % sizeof(resolution_cache_entry_t) != 0) {
+    ESP_LOGW(TAG, "Ignoring stored resolutions: %s", esp_err_to_name(err));
+    return;
+  }
+
+  s_count = size / sizeof(resolution_cache_entry_t);
+  ESP_LOGD(TAG, "Loaded %d verified resolutions", s_count);
+}
+
+esp_err_t resolution_apply(const onewire_device_t *device, int resolution) {
+  if (device == NULL || resolution < 9 || resolution > 12) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  resolution_cache_entry_t *entry = find_entry(device->address);
+  if (entry != NULL && entry->resolution == resolution) {
+    ESP_LOGD(TAG, "Sensor %016llX verified at %d bits", device->address,
+             resolution);
+    return ESP_OK;
+  }
+
+  ESP_RETURN_ON_ERROR(program_eeprom(device, resolution), TAG,
+                      "Failed to program resolution");
+  store_entry(device->address, resolution);
+
+  return ESP_OK;
+}
+
+esp_err_t resolution_save(void) {
+  if (!s_dirty) {
+    return ESP_OK;
+  }
+
+  nvs_handle_t handle;
+  ESP_RETURN_ON_ERROR(
+      nvs_open(RESOLUTION_NVS_NAMESPACE, NVS_READWRITE, &handle), TAG,
+      "Failed to open NVS");
+
+  esp_err_t err = nvs_set_blob(handle, RESOLUTION_NVS_KEY, s_cache,
+                               s_count * sizeof(resolution_cache_entry_t));
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (err == ESP_OK) {
+    s_dirty = false;
+    ESP_LOGI(TAG, "Stored %d verified resolutions", s_count);
+  }
+
+  return err;
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,56 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "onewire_device.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief A sensor whose EEPROM is known to hold a given resolution.
+ */
+typedef struct {
+  uint64_t address;   ///< ROM code of the sensor
+  uint8_t resolution; ///< Resolution stored in the EEPROM, in bits
+} resolution_cache_entry_t;
+
+/**
+ * @brief Loads the verified resolutions from NVS.
+ *
+ * Must be called before `resolution_apply()`. A missing or unreadable cache
+ * is not an error, the sensors are then checked on the bus.
+ *
+ * @return void
+ */
+void resolution_init(void);
+
+/**
+ * @brief Makes a sensor convert at the configured resolution.
+ *
+ * If the NVS cache does not already record the sensor at this resolution,
+ * the EEPROM configuration is recalled and read from the scratchpad. When it
+ * differs, the resolution is written, copied to the EEPROM and read back to
+ * verify it, so the EEPROM is only written when the configuration changes.
+ * The scratchpad then holds the EEPROM configuration, which the sensor also
+ * loads at power-up.
+ *
+ * @param device the 1-Wire device of the sensor.
+ * @param resolution the configured resolution, between 9 and 12 bits.
+ * @return ESP_OK on success, ESP_ERR_INVALID_RESPONSE if the EEPROM does not
+ * hold the resolution after programming, otherwise an error code.
+ */
+esp_err_t resolution_apply(const onewire_device_t *device, int resolution);
+
+/**
+ * @brief Writes the verified resolutions to NVS, if they changed.
+ *
+ * @return ESP_OK on success, otherwise an error code from NVS.
+ */
+esp_err_t resolution_save(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // RESOLUTION_H
@@ -0,0 +1,200 @@
+#include "scanner.h"
+
+#include <stdio.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sensor.h"
+
+#ifdef CONFIG_ESP_SCANNER_MODE
+
+static const char *TAG = "scanner";
+
+#define SCANNER_TASK_STACK_SIZE 4096
+#define SCANNER_DEFAULT_RESOLUTION 12 ///< When the scratchpad is unreadable
+
+static TaskHandle_t s_caller = NULL; // Task waiting for the searches
+
+static void read_device(const onewire_device_t *device,
+                        scanner_device_t *found) {
+  uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+
+  *found = (scanner_device_t){.address = device->address};
+
+  if (sensor_read_scratchpad(device, scratchpad) == ESP_OK) {
+    found->resolution =
+        config_to_resolution(scratchpad[DS18B20_SCRATCHPAD_CONFIG]);
+  }
+
+  if (sensor_read_power_supply(device, &found->parasitic) == ESP_OK) {
+    found->power_known = true;
+  }
+}
+
+static esp_err_t search_bus(scanner_bus_t *bus) {
+  onewire_device_iter_handle_t iter = NULL;
+  onewire_device_t device;
+  esp_err_t err;
+
+  ESP_RETURN_ON_ERROR(onewire_new_device_iter(bus->handle, &iter), TAG,
+                      "Failed to create device iterator on GPIO %d", bus->pin);
+
+  while ((err = onewire_device_iter_get_next(iter, &device)) == ESP_OK) {
+    if ((device.address & 0xFF) != DS18B20_FAMILY_CODE) {
+      ESP_LOGD(TAG, "Ignoring %016llX on GPIO %d, not a DS18B20",
+               device.address, bus->pin);
+      bus->ignored_count++;
+      continue;
+    }
+
+    if (bus->device_count >= CONFIG_ESP_MAX_SENSORS) {
+      ESP_LOGW(TAG, "Ignoring %016llX on GPIO %d, too many sensors",
+               device.address, bus->pin);
+      bus->ignored_count++;
+      continue;
+    }
+
+    read_device(&device, &bus->devices[bus->device_count++]);
+  }
+
+  onewire_del_device_iter(iter);
+
+  // The iterator reports the end of the search as not found
+  return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
+static void scan_task(void *arg) {
+  scanner_bus_t *bus = arg;
+
+  int64_t start = esp_timer_get_time();
+  bus->err = search_bus(bus);
+  bus->elapsed_us = esp_timer_get_time() - start;
+
+  xTaskNotifyGive(s_caller);
+  vTaskDelete(NULL);
+}
+
+void scanner_run(scanner_bus_t *buses, int count) {
+  s_caller = xTaskGetCurrentTaskHandle();
+
+  int started = 0;
+  for (int i = 0; i < count; i++) {
+    buses[i].device_count = 0;
+    buses[i].ignored_count = 0;
+    buses[i].elapsed_us = 0;
+
+    if (buses[i].handle == NULL) {
+      buses[i].err = ESP_ERR_INVALID_STATE;
+      continue;
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), "scan_%d", buses[i].pin);
+
+    // Each bus has its own RMT channels, the searches do not interfere
+    if (xTaskCreate(scan_task, name, SCANNER_TASK_STACK_SIZE, &buses[i],
+                    tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+      ESP_LOGE(TAG, "Failed to start the search of GPIO %d", buses[i].pin);
+      buses[i].err = ESP_ERR_NO_MEM;
+      continue;
+    }
+    started++;
+  }
+
+  // Each task gives one notification when its search is over
+  while (started > 0) {
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    started--;
+  }
+}
+
+static void log_bus(int i, const scanner_bus_t *bus) {
+  if (bus->err != ESP_OK && bus->device_count == 0) {
+    ESP_LOGE(TAG, "Bus %d (GPIO %d): search failed: %s", i, bus->pin,
+             esp_err_to_name(bus->err));
+    return;
+  }
+
+  if (bus->err != ESP_OK) {
+    ESP_LOGW(TAG, "Bus %d (GPIO %d): search interrupted, results partial: %s",
+             i, bus->pin, esp_err_to_name(bus->err));
+  }
+
+  ESP_LOGI(TAG, "Bus %d (GPIO %d): %d DS18B20, %d ignored, scanned in %lld ms",
+           i, bus->pin, bus->device_count, bus->ignored_count,
+           (long long)(bus->elapsed_us / 1000));
+
+  for (int j = 0; j < bus->device_count; j++) {
+    const scanner_device_t *device = &bus->devices[j];
+    const char *power = !device->power_known ? "unknown power"
+                        : device->parasitic  ? "parasitic power"
+                                             : "external power";
+    if (device->resolution == 0) {
+      ESP_LOGI(TAG, "  %016llX: unknown resolution, %s", device->address,
+               power);
+    } else {
+      ESP_LOGI(TAG, "  %016llX: %d-bit, %s", device->address,
+               device->resolution, power);
+    }
+  }
+}
+
+int scanner_print_results(const scanner_bus_t *buses, int count) {
+  int total = 0;
+  bool parasitic = false;
+
+  for (int i = 0; i < count; i++) {
+    log_bus(i, &buses[i]);
+
+    total += buses[i].device_count;
+    for (int j = 0; j < buses[i].device_count; j++) {
+      parasitic |= buses[i].devices[j].parasitic;
+    }
+  }
+
+  if (total == 0) {
+    ESP_LOGW(TAG, "No DS18B20 found");
+    return 0;
+  }
+
+  if (parasitic) {
+    ESP_LOGW(TAG, "Parasitically powered sensors found, their resolution "
+                  "cannot be stored in EEPROM without a strong pull-up");
+  }
+
+  if (total > CONFIG_ESP_MAX_SENSORS) {
+    ESP_LOGW(TAG, "%d sensors found, ESP_MAX_SENSORS must be raised to use "
+                  "the configuration below",
+             total);
+  }
+
+  // Printed without log prefix, so the line can be pasted into sdkconfig
+  int idx = 1;
+  bool first_bus = true;
+  printf("CONFIG_ESP_ONE_WIRE_CONFIG_STRING=\"");
+  for (int i = 0; i < count; i++) {
+    const scanner_bus_t *bus = &buses[i];
+    if (bus->device_count == 0) {
+      continue;
+    }
+
+    printf("%s%d:", first_bus ? "" : ";", bus->pin);
+    first_bus = false;
+
+    for (int j = 0; j < bus->device_count; j++) {
+      const scanner_device_t *device = &bus->devices[j];
+      printf("%s%016llX,%d,%d", j == 0 ? "" : "|", device->address, idx++,
+             device->resolution != 0 ? device->resolution
+                                     : SCANNER_DEFAULT_RESOLUTION);
+    }
+  }
+  printf("\"\n");
+
+  return total;
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,64 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "onewire_bus.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief A DS18B20 found by the scanner.
+ */
+typedef struct {
+  uint64_t address;   ///< ROM code of the sensor
+  uint8_t resolution; ///< Current resolution in bits, 0 if it could not be read
+  bool parasitic;     ///< Whether the sensor is parasitically powered
+  bool power_known;   ///< Whether the power mode could be read
+} scanner_device_t;
+
+/**
+ * @brief The result of the search of a single bus.
+ */
+typedef struct {
+  int pin;                     ///< GPIO of the bus
+  onewire_bus_handle_t handle; ///< Bus handle, NULL if the bus is not usable
+  scanner_device_t devices[CONFIG_ESP_MAX_SENSORS]; ///< DS18B20 found
+  int device_count;   ///< Number of entries in `devices`
+  int ignored_count;  ///< Devices of another family, or in excess
+  esp_err_t err;      ///< Outcome of the search
+  int64_t elapsed_us; ///< Duration of the search
+} scanner_bus_t;
+
+/**
+ * @brief Searches every bus at the same time.
+ *
+ * One task is started per bus with a valid `handle`, so the total time is
+ * that of the slowest bus rather than the sum. Each task only touches its
+ * own `scanner_bus_t`. Returns once every search is over.
+ *
+ * @param buses the buses to search, `pin` and `handle` set by the caller.
+ * @param count number of entries in `buses`.
+ * @return void
+ */
+void scanner_run(scanner_bus_t *buses, int count);
+
+/**
+ * @brief Logs the search results and prints the matching configuration.
+ *
+ * The configuration is printed on a line of its own, without log prefix, in
+ * the sdkconfig format of `CONFIG_ESP_ONE_WIRE_CONFIG_STRING`. Sensors are
+ * numbered from 1 in search order and keep their current resolution.
+ *
+ * @param buses the searched buses.
+ * @param count number of entries in `buses`.
+ * @return int the number of sensors in the printed configuration.
+ */
+int scanner_print_results(const scanner_bus_t *buses, int count);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // SCANNER_H
@@ -0,0 +1,78 @@
+#include "scheduler.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+#define SCHEDULER_EARLY_MARGIN 1 ///< Seconds a reading may be taken early
+
+static const char *TAG = "scheduler";
+
+// Next deadline of each sensor, 0 until its first reading. 32 bits keep the
+// per-sensor state small and last until 2106.
+SENSOR_STATE_ATTR static uint32_t s_next_due[CONFIG_ESP_MAX_SENSORS];
+
+bool scheduler_is_due(int sensor, time_t now) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return false;
+  }
+
+  return s_next_due[sensor] <= now + SCHEDULER_EARLY_MARGIN;
+}
+
+void scheduler_mark_done(int sensor, int period, time_t now) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  time_t next = (time_t)s_next_due[sensor] + period;
+  if (s_next_due[sensor] == 0 || next <= now || next > now + period) {
+    // First reading, fell behind or the clock moved back
+    next = now + period;
+  }
+
+  s_next_due[sensor] = (uint32_t)next;
+  ESP_LOGD(TAG, "Sensor %d next due in %lld s", sensor,
+           (long long)(next - now));
+}
+
+void scheduler_limit(int sensor, int period, time_t now) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  if (s_next_due[sensor] > now + period) {
+    s_next_due[sensor] = (uint32_t)(now + period);
+  }
+}
+
+void scheduler_reset(void) { memset(s_next_due, 0, sizeof(s_next_due)); }
+
+int scheduler_seconds_until_next(const bool *ready, int num_sensors,
+                                 time_t now) {
+  bool found = false;
+  time_t earliest = 0;
+  for (int i = 0; i < num_sensors && i < CONFIG_ESP_MAX_SENSORS; i++) {
+    // Sensors that could not be set up are never read, nor scheduled
+    if (ready[i] && (!found || s_next_due[i] < earliest)) {
+      earliest = s_next_due[i];
+      found = true;
+    }
+  }
+
+  if (!found) {
+    return CONFIG_ESP_SLEEP_DURATION;
+  }
+
+  if (earliest <= now) {
+    return 1;
+  }
+
+  return earliest - now;
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,71 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Returns whether a sensor is due for a reading.
+ *
+ * Sensors that were never read are always due. A sensor due within
+ * `SCHEDULER_EARLY_MARGIN` seconds is considered due, so a wake that happens
+ * slightly early does not cause another one right after.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param now The current time (RTC wall clock).
+ * @return true if the sensor should be read this wake.
+ */
+bool scheduler_is_due(int sensor, time_t now);
+
+/**
+ * @brief Schedules the next reading of a sensor.
+ *
+ * The next deadline is one period after the previous one, so the readings do
+ * not drift with the length of the wake cycles. A sensor that fell behind by
+ * a whole period is rescheduled from `now`.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param period The sampling period of the sensor, in seconds.
+ * @param now The current time (RTC wall clock).
+ * @return void
+ */
+void scheduler_mark_done(int sensor, int period, time_t now);
+
+/**
+ * @brief Brings the next reading of a sensor forward after its period was
+ * shortened, so it is due at most one new period from `now`.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param period The new sampling period of the sensor, in seconds.
+ * @param now The current time (RTC wall clock).
+ * @return void
+ */
+void scheduler_limit(int sensor, int period, time_t now);
+
+/**
+ * @brief Returns the number of seconds until the earliest next deadline of
+ * the ready sensors.
+ *
+ * @param ready Whether each sensor was set up, the others are never read.
+ * @param num_sensors The number of configured sensors.
+ * @param now The current time (RTC wall clock).
+ * @return int Seconds to sleep, at least 1. `CONFIG_ESP_SLEEP_DURATION` when
+ * no sensor is ready.
+ */
+int scheduler_seconds_until_next(const bool *ready, int num_sensors,
+                                 time_t now);
+
+/**
+ * @brief Forgets the deadlines of every sensor.
+ *
+ * Called when the sensors are renumbered, e.g. after a discovery.
+ *
+ * @return void
+ */
+void scheduler_reset(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // SCHEDULER_H
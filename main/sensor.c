@@ -1,5 +1,6 @@
 #include "sensor.h"
 
+#include "esp_check.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -7,6 +8,21 @@
 
 static const char *TAG = "sensor";
 
+#define DS18B20_CMD_WRITE_SCRATCHPAD 0x4E
+#define DS18B20_CMD_READ_SCRATCHPAD 0xBE
+#define DS18B20_CMD_COPY_SCRATCHPAD 0x48
+#define DS18B20_CMD_RECALL_EEPROM 0xB8
+#define DS18B20_CMD_CONVERT_TEMP 0x44
+#define DS18B20_CMD_READ_POWER_SUPPLY 0xB4
+
+// Bit 7 of the configuration register reads 0 and bits 0 to 4 read 1, a
+// line stuck low or high cannot produce them
+#define DS18B20_CONFIG_FIXED_MASK 0x9F
+#define DS18B20_CONFIG_FIXED_BITS 0x1F
+
+#define DS18B20_EEPROM_WRITE_TIME_MS 10 ///< Maximum EEPROM write time
+#define DS18B20_RECALL_MAX_POLLS 10     ///< Read slots before a recall fails
+
 esp_err_t init_sensor_bus(int pin, onewire_bus_handle_t *bus_handle) {
   if (pin < 0) {
     ESP_LOGE(TAG, "Invalid pin number: %d", pin);
@@ -35,67 +51,135 @@ esp_err_t init_sensor_bus(int pin, onewire_bus_handle_t *bus_handle) {
   return ESP_OK;
 }
 
-#ifdef CONFIG_ESP_SCANNER_MODE
-
-void sensor_scan(onewire_bus_handle_t bus) {
-  onewire_device_iter_handle_t iter = NULL;
-  onewire_device_t device;
-  esp_err_t search_result;
+/**
+ * Resets the bus and addresses a single device, then sends `command`.
+ */
+static esp_err_t send_command(const onewire_device_t *device,
+                              uint8_t command) {
+  uint8_t tx_buffer[10] = {ONEWIRE_CMD_MATCH_ROM};
+  for (int i = 0; i < 8; i++) {
+    // The ROM code is sent least significant byte first
+    tx_buffer[i + 1] = (device->address >> (i * 8)) & 0xFF;
+  }
+  tx_buffer[9] = command;
 
-  ESP_ERROR_CHECK(onewire_new_device_iter(bus, &iter));
+  ESP_RETURN_ON_ERROR(onewire_bus_reset(device->bus), TAG,
+                      "No presence pulse from %016llX", device->address);
+  return onewire_bus_write_bytes(device->bus, tx_buffer, sizeof(tx_buffer));
+}
 
-  ESP_LOGI(TAG, "Starting OneWire device scan...");
-  while ((search_result = onewire_device_iter_get_next(iter, &device)) ==
-         ESP_OK) {
-    ESP_LOGI(TAG, "Found device with address: %016llX", device.address);
+esp_err_t sensor_read_scratchpad(const onewire_device_t *device,
+                                 uint8_t *scratchpad) {
+  ESP_RETURN_ON_ERROR(send_command(device, DS18B20_CMD_READ_SCRATCHPAD), TAG,
+                      "Failed to send read scratchpad command");
+  ESP_RETURN_ON_ERROR(onewire_bus_read_bytes(device->bus, scratchpad,
+                                             DS18B20_SCRATCHPAD_SIZE),
+                      TAG, "Failed to read scratchpad");
+
+  if (onewire_crc8(0, scratchpad, DS18B20_SCRATCHPAD_SIZE - 1) !=
+      scratchpad[DS18B20_SCRATCHPAD_SIZE - 1]) {
+    ESP_LOGW(TAG, "Scratchpad CRC mismatch for %016llX", device->address);
+    return ESP_ERR_INVALID_CRC;
   }
-  ESP_ERROR_CHECK(onewire_del_device_iter(iter));
 
-  if (search_result == ESP_ERR_NOT_FOUND) {
-    ESP_LOGI(TAG, "No more devices found");
-  } else {
-    ESP_LOGE(TAG, "Error occurred during device scan: %d", search_result);
+  // Nine zero bytes pass the CRC check
+  if ((scratchpad[DS18B20_SCRATCHPAD_CONFIG] & DS18B20_CONFIG_FIXED_MASK) !=
+      DS18B20_CONFIG_FIXED_BITS) {
+    ESP_LOGW(TAG, "Invalid scratchpad for %016llX", device->address);
+    return ESP_ERR_INVALID_RESPONSE;
   }
+
+  return ESP_OK;
 }
 
-#else // CONFIG_ESP_SCANNER_MODE
+esp_err_t sensor_read_power_supply(const onewire_device_t *device,
+                                   bool *parasitic) {
+  ESP_RETURN_ON_ERROR(send_command(device, DS18B20_CMD_READ_POWER_SUPPLY), TAG,
+                      "Failed to send read power supply command");
 
-esp_err_t init_onewire_device(onewire_bus_handle_t bus, uint64_t address,
-                              onewire_device_t *device_handle) {
-  if (device_handle == NULL) {
-    ESP_LOGE(TAG, "Device handle cannot be NULL");
-    return ESP_ERR_INVALID_ARG;
-  }
+  // Parasitically powered sensors pull the read slot low
+  uint8_t external = 0;
+  ESP_RETURN_ON_ERROR(onewire_bus_read_bit(device->bus, &external), TAG,
+                      "Failed to read power supply");
+  *parasitic = !external;
 
-  ESP_LOGD(TAG, "Initializing 1-Wire device with address: %016llX", address);
+  return ESP_OK;
+}
 
-  *device_handle = (onewire_device_t){
-      .bus = bus,
-      .address = address,
-  };
+int config_to_resolution(uint8_t config) { return ((config >> 5) & 0x03) + 9; }
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+esp_err_t sensor_write_scratchpad(const onewire_device_t *device, uint8_t th,
+                                  uint8_t tl, uint8_t config) {
+  const uint8_t tx_buffer[3] = {th, tl, config};
+
+  ESP_RETURN_ON_ERROR(send_command(device, DS18B20_CMD_WRITE_SCRATCHPAD), TAG,
+                      "Failed to send write scratchpad command");
+  return onewire_bus_write_bytes(device->bus, tx_buffer, sizeof(tx_buffer));
+}
+
+esp_err_t sensor_copy_scratchpad(const onewire_device_t *device) {
+  ESP_RETURN_ON_ERROR(send_command(device, DS18B20_CMD_COPY_SCRATCHPAD), TAG,
+                      "Failed to send copy scratchpad command");
+
+  vTaskDelay(pdMS_TO_TICKS(DS18B20_EEPROM_WRITE_TIME_MS));
 
   return ESP_OK;
 }
 
-esp_err_t init_ds18b20_sensor(onewire_bus_handle_t bus, uint64_t address,
-                              onewire_device_t *device_handle,
-                              ds18b20_device_handle_t *sensor_handle) {
-  if (sensor_handle == NULL) {
-    ESP_LOGE(TAG, "Sensor handle cannot be NULL");
-    return ESP_ERR_INVALID_ARG;
+esp_err_t sensor_recall_eeprom(const onewire_device_t *device) {
+  ESP_RETURN_ON_ERROR(send_command(device, DS18B20_CMD_RECALL_EEPROM), TAG,
+                      "Failed to send recall command");
+
+  // The sensor answers 0 to read slots until the recall is done
+  for (int i = 0; i < DS18B20_RECALL_MAX_POLLS; i++) {
+    uint8_t done = 0;
+    ESP_RETURN_ON_ERROR(onewire_bus_read_bit(device->bus, &done), TAG,
+                        "Failed to poll recall status");
+    if (done) {
+      return ESP_OK;
+    }
   }
 
-  ESP_LOGD(TAG, "Initializing DS18B20 sensor with address: %016llX", address);
+  return ESP_ERR_TIMEOUT;
+}
 
-  ds18b20_config_t config = {};
+esp_err_t sensor_set_resolution(const onewire_device_t *device,
+                                int resolution) {
+  uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
 
-  esp_err_t err = ds18b20_new_device(device_handle, &config, sensor_handle);
+  // Read first, so the alarm registers are written back unchanged
+  ESP_RETURN_ON_ERROR(sensor_read_scratchpad(device, scratchpad), TAG,
+                      "Failed to read scratchpad of %016llX", device->address);
+  return sensor_write_scratchpad(device, scratchpad[DS18B20_SCRATCHPAD_TH],
+                                 scratchpad[DS18B20_SCRATCHPAD_TL],
+                                 resolution_to_config(resolution));
+}
 
-  if (err != ESP_OK) {
-    return err;
-  }
+esp_err_t sensor_trigger_conversion(const onewire_device_t *device) {
+  return send_command(device, DS18B20_CMD_CONVERT_TEMP);
+}
 
-  return ESP_OK;
+esp_err_t sensor_broadcast_conversion(onewire_bus_handle_t bus) {
+  const uint8_t tx_buffer[2] = {ONEWIRE_CMD_SKIP_ROM, DS18B20_CMD_CONVERT_TEMP};
+
+  ESP_RETURN_ON_ERROR(onewire_bus_reset(bus), TAG,
+                      "No presence pulse on the bus");
+  return onewire_bus_write_bytes(bus, tx_buffer, sizeof(tx_buffer));
+}
+
+int16_t sensor_scratchpad_temperature(const uint8_t *scratchpad,
+                                      int resolution) {
+  int16_t raw = (int16_t)(scratchpad[1] << 8 | scratchpad[0]);
+
+  // Each bit of resolution below 12 leaves one more low bit undefined
+  return raw & ~((1 << (12 - resolution)) - 1);
+}
+
+uint8_t resolution_to_config(int resolution) {
+  // R1 and R0 are bits 6 and 5, the other bits read as 1
+  return ((resolution - 9) << 5) | 0x1F;
 }
 
 ds18b20_resolution_t int_to_resolution(int resolution) {
@@ -14,41 +14,137 @@
  */
 esp_err_t init_sensor_bus(int pin, onewire_bus_handle_t *bus_handle);
 
-#ifdef CONFIG_ESP_SCANNER_MODE
+#define DS18B20_FAMILY_CODE 0x28 ///< Family code, lowest byte of the ROM code
+
+#define DS18B20_SCRATCHPAD_SIZE 9 ///< Scratchpad length, CRC byte included
+#define DS18B20_SCRATCHPAD_TH 2     ///< Position of the TH alarm register
+#define DS18B20_SCRATCHPAD_TL 3     ///< Position of the TL alarm register
+#define DS18B20_SCRATCHPAD_CONFIG 4 ///< Position of the configuration register
 
 /**
- * @brief Perform a sensor scan on the given 1-Wire bus and
- * print the results to the serial console.
+ * @brief Reads the scratchpad of a DS18B20 sensor and checks its CRC and the
+ * fixed bits of its configuration register.
  *
- * @param bus the 1-Wire bus handle.
+ * @param device the 1-Wire device to read from.
+ * @param scratchpad buffer receiving the `DS18B20_SCRATCHPAD_SIZE` bytes.
+ * @return ESP_OK on success, ESP_ERR_INVALID_CRC if the CRC does not match,
+ * ESP_ERR_INVALID_RESPONSE if the fixed bits are wrong, e.g. for a data line
+ * stuck low, otherwise an error code from the bus.
  */
-void sensor_scan(onewire_bus_handle_t bus);
+esp_err_t sensor_read_scratchpad(const onewire_device_t *device,
+                                 uint8_t *scratchpad);
 
-#else
+/**
+ * @brief Reads whether a DS18B20 sensor is parasitically powered.
+ *
+ * @param device the 1-Wire device to query.
+ * @param parasitic set to true if the sensor draws its power from the data
+ * line, false if it has an external supply.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_read_power_supply(const onewire_device_t *device,
+                                   bool *parasitic);
 
 /**
- * @brief Initializes a 1-Wire device with the given address on the bus.
+ * @brief Extracts the resolution in bits from a configuration register value.
  *
- * @param bus the 1-Wire bus handle.
- * @param address the 1-Wire device address.
- * @param device_handle pointer to store the initialized device handle.
- * @return ESP_OK if initialization is successful, otherwise an error code.
+ * @param config the configuration register value.
+ * @return int the resolution, between 9 and 12 bits.
+ */
+int config_to_resolution(uint8_t config);
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Writes the alarm and configuration registers of a DS18B20 sensor.
+ *
+ * Only the scratchpad (RAM) is written, the EEPROM is left untouched.
+ *
+ * @param device the 1-Wire device to write to.
+ * @param th the TH alarm register.
+ * @param tl the TL alarm register.
+ * @param config the configuration register.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_write_scratchpad(const onewire_device_t *device, uint8_t th,
+                                  uint8_t tl, uint8_t config);
+
+/**
+ * @brief Copies the alarm and configuration registers to the EEPROM.
+ *
+ * Waits for the EEPROM write to complete before returning. Sensors in
+ * parasitic power mode need a strong pull-up during the write, which the RMT
+ * bus does not provide.
+ *
+ * @param device the 1-Wire device to program.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_copy_scratchpad(const onewire_device_t *device);
+
+/**
+ * @brief Reloads the alarm and configuration registers from the EEPROM.
+ *
+ * @param device the 1-Wire device to reload.
+ * @return ESP_OK on success, ESP_ERR_TIMEOUT if the recall did not complete,
+ * otherwise an error code from the bus.
  */
-esp_err_t init_onewire_device(onewire_bus_handle_t bus, uint64_t address,
-                              onewire_device_t *device_handle);
+esp_err_t sensor_recall_eeprom(const onewire_device_t *device);
 
 /**
- * @brief Initializes a DS18B20 sensor with the given address on the bus.
+ * @brief Sets the resolution of the next conversions of a DS18B20 sensor.
+ *
+ * Only the configuration register of the scratchpad is changed, the alarm
+ * registers are kept and the EEPROM is left untouched, so the sensor returns
+ * to its stored resolution after a power cycle.
+ *
+ * @param device the 1-Wire device to configure.
+ * @param resolution the resolution, between 9 and 12 bits.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_set_resolution(const onewire_device_t *device,
+                                int resolution);
+
+/**
+ * @brief Starts a temperature conversion on a single sensor.
+ *
+ * Returns as soon as the command is sent, the caller waits for the
+ * conversion time before reading the result.
+ *
+ * @param device the 1-Wire device to trigger.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_trigger_conversion(const onewire_device_t *device);
+
+/**
+ * @brief Starts a temperature conversion on every sensor of a bus.
+ *
+ * Returns as soon as the command is sent, the caller waits for the
+ * conversion time of the slowest sensor before reading the results.
  *
  * @param bus the 1-Wire bus handle.
- * @param address the 1-Wire device address.
- * @param device_handle pointer to store the initialized device handle.
- * @param sensor_handle pointer to store the initialized sensor handle.
- * @return ESP_OK if initialization is successful, otherwise an error code.
+ * @return ESP_OK on success, otherwise an error code from the bus.
+ */
+esp_err_t sensor_broadcast_conversion(onewire_bus_handle_t bus);
+
+/**
+ * @brief Extracts the temperature from a scratchpad.
+ *
+ * The bits left undefined by the resolution are cleared.
+ *
+ * @param scratchpad the scratchpad, as read by `sensor_read_scratchpad()`.
+ * @param resolution the resolution of the conversion, in bits.
+ * @return int16_t the temperature, in sixteenths of a degree Celsius.
+ */
+int16_t sensor_scratchpad_temperature(const uint8_t *scratchpad,
+                                      int resolution);
+
+/**
+ * @brief Converts a resolution in bits to a configuration register value.
+ *
+ * @param resolution the resolution, between 9 and 12 bits.
+ * @return uint8_t the configuration register value.
  */
-esp_err_t init_ds18b20_sensor(onewire_bus_handle_t bus, uint64_t address,
-                              onewire_device_t *device_handle,
-                              ds18b20_device_handle_t *sensor_handle);
+uint8_t resolution_to_config(int resolution);
 
 /**
  * @brief Converts an integer to a `ds18b20_resolution_t` value.
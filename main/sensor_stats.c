@@ -0,0 +1,55 @@
+#include "sensor_stats.h"
+
+#include <string.h>
+
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+SENSOR_STATE_ATTR static sensor_stats_t s_stats[CONFIG_ESP_MAX_SENSORS];
+
+void sensor_stats_record_error(int sensor, esp_err_t result) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  sensor_stats_t *s = &s_stats[sensor];
+  bool corrupt =
+      result == ESP_ERR_INVALID_CRC || result == ESP_ERR_INVALID_RESPONSE;
+  if (corrupt && s->crc_errors < UINT16_MAX) {
+    s->crc_errors++;
+  } else if (result == ESP_ERR_NOT_FOUND && s->presence_errors < UINT16_MAX) {
+    s->presence_errors++;
+  }
+}
+
+void sensor_stats_record(int sensor, esp_err_t result) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  s_stats[sensor].reads++;
+  sensor_stats_record_error(sensor, result);
+}
+
+void sensor_stats_record_retry(int sensor) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return;
+  }
+
+  if (s_stats[sensor].retries < UINT16_MAX) {
+    s_stats[sensor].retries++;
+  }
+}
+
+void sensor_stats_reset(void) { memset(s_stats, 0, sizeof(s_stats)); }
+
+const sensor_stats_t *sensor_stats_get(int sensor) {
+  if (sensor < 0 || sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return NULL;
+  }
+
+  return &s_stats[sensor];
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
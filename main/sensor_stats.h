@@ -0,0 +1,73 @@
+#ifndef SENSOR_STATS_H
+#define SENSOR_STATS_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Bus error counters of a sensor.
+ *
+ * They accumulate across deep sleep, until the next power-on reset. The
+ * error counters stop at `UINT16_MAX`.
+ */
+typedef struct {
+  uint32_t reads;           ///< Scratchpad reads attempted
+  uint16_t crc_errors;      ///< Reads with a corrupt scratchpad
+  uint16_t presence_errors; ///< Bus resets without a presence pulse
+  uint16_t retries;         ///< Reads repeated after a failure
+} sensor_stats_t;
+
+/**
+ * @brief Counts a scratchpad read and its outcome.
+ *
+ * `ESP_ERR_INVALID_CRC` and `ESP_ERR_INVALID_RESPONSE` count as a corrupt
+ * scratchpad and `ESP_ERR_NOT_FOUND` as a missing presence pulse.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param result The result of the read.
+ * @return void
+ */
+void sensor_stats_record(int sensor, esp_err_t result);
+
+/**
+ * @brief Counts a failed bus transaction other than a scratchpad read, such
+ * as a conversion that could not be triggered.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @param result The error of the transaction.
+ * @return void
+ */
+void sensor_stats_record_error(int sensor, esp_err_t result);
+
+/**
+ * @brief Counts a retry of a failed reading.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @return void
+ */
+void sensor_stats_record_retry(int sensor);
+
+/**
+ * @brief Returns the counters of a sensor.
+ *
+ * @param sensor Flat index of the sensor in the configuration.
+ * @return const sensor_stats_t* The counters, or NULL if the index is out of
+ * range.
+ */
+const sensor_stats_t *sensor_stats_get(int sensor);
+
+/**
+ * @brief Forgets the bus error counters of every sensor.
+ *
+ * Called when the sensors are renumbered, e.g. after a discovery.
+ *
+ * @return void
+ */
+void sensor_stats_reset(void);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // SENSOR_STATS_H
@@ -1,8 +1,24 @@
 #ifndef SENSOR_TYPES_H
 #define SENSOR_TYPES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Places the per-sensor state that must survive a deep sleep.
+ *
+ * Only deep sleep needs RTC slow memory, so builds that never sleep keep the
+ * state in ordinary RAM and are not bound by its 8 KB.
+ */
+#ifdef CONFIG_ESP_SLEEP_MODE
+#define SENSOR_STATE_ATTR RTC_DATA_ATTR
+#else
+#define SENSOR_STATE_ATTR
+#endif
+
 #ifndef CONFIG_ESP_SCANNER_MODE
 
 /**
@@ -11,8 +27,30 @@
 typedef struct {
   int idx;           /**< The index of the sensor. */
   float temperature; /**< The temperature reading. */
+  bool valid;        /**< Whether the reading was taken this cycle. */
+  uint8_t resolution; /**< The resolution of the conversion, in bits. */
+  uint16_t spread;    /**< Spread of the oversampled conversions, in
+                           sixteenths of a degree. */
 } sensor_reading_t;
 
+/**
+ * @brief The configured sensors, as a structure of arrays.
+ *
+ * Built once from the 1-Wire configuration when the sensors are set up, with
+ * the ROM codes already parsed. Entry `i` is the sensor with flat id `i`,
+ * whose reading is stored in slot `i` of the readings. The sensors of a bus
+ * are contiguous, in bus order, so the acquisition walks the table linearly,
+ * one bus after the other.
+ */
+typedef struct {
+  uint64_t rom[CONFIG_ESP_MAX_SENSORS];       /**< ROM code. */
+  int idx[CONFIG_ESP_MAX_SENSORS];            /**< Index of the sensor. */
+  int period[CONFIG_ESP_MAX_SENSORS];         /**< Sampling period, in s. */
+  uint8_t bus[CONFIG_ESP_MAX_SENSORS];        /**< Position of the bus. */
+  uint8_t resolution[CONFIG_ESP_MAX_SENSORS]; /**< Configured resolution. */
+  bool ready[CONFIG_ESP_MAX_SENSORS]; /**< Whether the sensor was set up. */
+} device_table_t;
+
 #endif // CONFIG_ESP_SCANNER_MODE
 
 #endif // SENSOR_TYPES_H
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "supervisor.h"
+
+#include <stdbool.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "supervisor";
+
+// The main task and the acquisition task of the pipeline
+#define SUPERVISOR_MAX_TASKS 2
+
+static const uint32_t s_phase_budgets_ms[SUPERVISOR_PHASE_COUNT] = {
+    [SUPERVISOR_PHASE_ACQUISITION] = CONFIG_ESP_ACQUISITION_BUDGET,
+    [SUPERVISOR_PHASE_CONNECT] = CONFIG_ESP_CONNECT_BUDGET,
+    [SUPERVISOR_PHASE_PUBLISH] = CONFIG_ESP_PUBLISH_BUDGET,
+};
+
+static const char *s_phase_names[SUPERVISOR_PHASE_COUNT + 1] = {
+    [SUPERVISOR_PHASE_ACQUISITION] = "acquisition",
+    [SUPERVISOR_PHASE_CONNECT] = "connect",
+    [SUPERVISOR_PHASE_PUBLISH] = "publish",
+    [SUPERVISOR_PHASE_NONE] = "cycle",
+};
+
+/**
+ * The phase a task is in, with the timer of its budget.
+ */
+typedef struct {
+  TaskHandle_t task; ///< NULL when the slot is free
+  volatile supervisor_phase_t phase; ///< Phase of the task
+  esp_timer_handle_t timer;          ///< Budget of the phase
+} supervisor_slot_t;
+
+RTC_DATA_ATTR static supervisor_stats_t s_stats = {0};
+
+static esp_timer_handle_t s_cycle_timer = NULL;
+static supervisor_slot_t s_slots[SUPERVISOR_MAX_TASKS];
+static portMUX_TYPE s_slots_lock = portMUX_INITIALIZER_UNLOCKED;
+static supervisor_overrun_handler_t s_handler = NULL;
+static void *s_handler_arg = NULL;
+static int64_t s_cycle_start_us = 0;
+static bool s_armed = false;
+
+static void overrun(supervisor_phase_t phase) {
+  if (phase == SUPERVISOR_PHASE_NONE) {
+    s_stats.cycle_overruns++;
+    s_stats.last_cycle_ms = CONFIG_ESP_CYCLE_BUDGET;
+  } else {
+    s_stats.phase_overruns[phase]++;
+    s_stats.last_cycle_ms =
+        (uint32_t)((esp_timer_get_time() - s_cycle_start_us) / 1000);
+  }
+
+  ESP_LOGE(TAG, "Budget exceeded: %s", s_phase_names[phase]);
+
+  if (s_handler != NULL) {
+    s_handler(phase, s_handler_arg);
+  }
+}
+
+static void cycle_timer_callback(void *arg) { overrun(SUPERVISOR_PHASE_NONE); }
+
+static void phase_timer_callback(void *arg) {
+  supervisor_slot_t *slot = arg;
+  overrun(slot->phase);
+}
+
+/**
+ * Returns the slot of the calling task. A task without one takes a free slot
+ * if `take`, otherwise, or when none is free, NULL is returned.
+ */
+static supervisor_slot_t *task_slot(bool take) {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  supervisor_slot_t *found = NULL;
+
+  portENTER_CRITICAL(&s_slots_lock);
+  for (int i = 0; i < SUPERVISOR_MAX_TASKS && found == NULL; i++) {
+    if (s_slots[i].task == task) {
+      found = &s_slots[i];
+    }
+  }
+  for (int i = 0; i < SUPERVISOR_MAX_TASKS && found == NULL && take; i++) {
+    if (s_slots[i].task == NULL) {
+      found = &s_slots[i];
+      found->task = task;
+    }
+  }
+  portEXIT_CRITICAL(&s_slots_lock);
+  return found;
+}
+
+static void end_slot(supervisor_slot_t *slot) {
+  if (slot->timer != NULL) {
+    // Fails harmlessly when the timer is not running
+    esp_timer_stop(slot->timer);
+  }
+  slot->phase = SUPERVISOR_PHASE_NONE;
+  slot->task = NULL;
+}
+
+esp_err_t supervisor_init(supervisor_overrun_handler_t handler, void *arg) {
+  s_handler = handler;
+  s_handler_arg = arg;
+
+  const esp_timer_create_args_t cycle_timer_args = {
+      .callback = cycle_timer_callback,
+      .name = "cycle_budget",
+  };
+  esp_err_t err = esp_timer_create(&cycle_timer_args, &s_cycle_timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  for (int i = 0; i < SUPERVISOR_MAX_TASKS; i++) {
+    s_slots[i].phase = SUPERVISOR_PHASE_NONE;
+    const esp_timer_create_args_t phase_timer_args = {
+        .callback = phase_timer_callback,
+        .arg = &s_slots[i],
+        .name = "phase_budget",
+    };
+    err = esp_timer_create(&phase_timer_args, &s_slots[i].timer);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+void supervisor_arm(void) {
+  s_cycle_start_us = esp_timer_get_time();
+  s_stats.cycles++;
+  s_armed = true;
+
+  if (CONFIG_ESP_CYCLE_BUDGET > 0 && s_cycle_timer != NULL) {
+    esp_timer_start_once(s_cycle_timer,
+                         (uint64_t)CONFIG_ESP_CYCLE_BUDGET * 1000);
+  }
+}
+
+void supervisor_disarm(void) {
+  if (!s_armed) {
+    return;
+  }
+
+  for (int i = 0; i < SUPERVISOR_MAX_TASKS; i++) {
+    end_slot(&s_slots[i]);
+  }
+  if (s_cycle_timer != NULL) {
+    esp_timer_stop(s_cycle_timer);
+  }
+
+  s_stats.last_cycle_ms =
+      (uint32_t)((esp_timer_get_time() - s_cycle_start_us) / 1000);
+  s_armed = false;
+
+  ESP_LOGD(TAG, "Cycle completed in %lu ms",
+           (unsigned long)s_stats.last_cycle_ms);
+}
+
+void supervisor_begin_phase(supervisor_phase_t phase) {
+  supervisor_end_phase();
+
+  if (phase >= SUPERVISOR_PHASE_COUNT) {
+    return;
+  }
+
+  supervisor_slot_t *slot = task_slot(true);
+  if (slot == NULL) {
+    ESP_LOGW(TAG, "No budget left for the %s phase", s_phase_names[phase]);
+    return;
+  }
+  slot->phase = phase;
+  if (s_phase_budgets_ms[phase] > 0 && slot->timer != NULL) {
+    esp_timer_start_once(slot->timer,
+                         (uint64_t)s_phase_budgets_ms[phase] * 1000);
+  }
+}
+
+void supervisor_end_phase(void) {
+  supervisor_slot_t *slot = task_slot(false);
+  if (slot != NULL) {
+    end_slot(slot);
+  }
+}
+
+const char *supervisor_phase_name(supervisor_phase_t phase) {
+  if (phase > SUPERVISOR_PHASE_NONE) {
+    return "unknown";
+  }
+  return s_phase_names[phase];
+}
+
+const supervisor_stats_t *supervisor_get_stats(void) { return &s_stats; }
@@ -0,0 +1,100 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief The phases of a wake cycle that have their own budget.
+ */
+typedef enum {
+  SUPERVISOR_PHASE_ACQUISITION, ///< Reading the sensors
+  SUPERVISOR_PHASE_CONNECT,     ///< Joining WiFi or connecting to a broker
+  SUPERVISOR_PHASE_PUBLISH,     ///< Sending readings to a broker
+  SUPERVISOR_PHASE_COUNT,
+  SUPERVISOR_PHASE_NONE = SUPERVISOR_PHASE_COUNT, ///< Outside any phase
+} supervisor_phase_t;
+
+/**
+ * @brief Overrun counters, kept in RTC memory across deep sleep.
+ */
+typedef struct {
+  uint32_t cycles;         ///< Supervised cycles since power-on
+  uint32_t cycle_overruns; ///< Cycles that exceeded the total budget
+  uint32_t phase_overruns[SUPERVISOR_PHASE_COUNT]; ///< Per-phase overruns
+  uint32_t last_cycle_ms; ///< Duration of the last completed cycle
+} supervisor_stats_t;
+
+/**
+ * @brief Called from the timer task when a budget is exceeded.
+ *
+ * The handler is expected to save what it can and force the device to
+ * sleep. It must not return to the interrupted work.
+ *
+ * @param phase The phase that overran, or SUPERVISOR_PHASE_NONE when the
+ * total cycle budget expired.
+ * @param arg The argument given to `supervisor_init()`.
+ */
+typedef void (*supervisor_overrun_handler_t)(supervisor_phase_t phase,
+                                             void *arg);
+
+/**
+ * @brief Creates the supervisor timers.
+ *
+ * @param handler The function called when a budget is exceeded.
+ * @param arg The argument passed to the handler.
+ * @return esp_err_t ESP_OK on success, otherwise an error code.
+ */
+esp_err_t supervisor_init(supervisor_overrun_handler_t handler, void *arg);
+
+/**
+ * @brief Starts a cycle and arms the total budget
+ * (`CONFIG_ESP_CYCLE_BUDGET` milliseconds).
+ *
+ * @return void
+ */
+void supervisor_arm(void);
+
+/**
+ * @brief Ends the cycle and disarms every budget.
+ *
+ * @return void
+ */
+void supervisor_disarm(void);
+
+/**
+ * @brief Enters a phase and arms its budget, replacing the previous phase of
+ * the calling task.
+ *
+ * Each task has its own phase, so the acquisition task of the pipeline is
+ * timed while the main task connects or publishes.
+ *
+ * @param phase The phase being entered.
+ * @return void
+ */
+void supervisor_begin_phase(supervisor_phase_t phase);
+
+/**
+ * @brief Leaves the current phase of the calling task and disarms its budget.
+ *
+ * @return void
+ */
+void supervisor_end_phase(void);
+
+/**
+ * @brief Returns the name of a phase, for logging and telemetry.
+ *
+ * @param phase The phase.
+ * @return const char* The phase name.
+ */
+const char *supervisor_phase_name(supervisor_phase_t phase);
+
+/**
+ * @brief Returns the overrun counters.
+ *
+ * @return const supervisor_stats_t* The counters.
+ */
+const supervisor_stats_t *supervisor_get_stats(void);
+
+#endif // SUPERVISOR_H
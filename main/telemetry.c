@@ -0,0 +1,203 @@
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+
+#include "health.h"
+#include "pacing.h"
+#include "payload.h"
+#include "power.h"
+#include "sensor_stats.h"
+#include "supervisor.h"
+#include "wifi.h"
+
+static const char *TAG = "telemetry";
+
+const char *telemetry_device_id(void) {
+  static char device_id[TELEMETRY_DEVICE_ID_LENGTH] = "";
+
+  if (device_id[0] == '\0') {
+    uint8_t mac[6] = {0};
+    esp_efuse_mac_get_default(mac);
+    snprintf(device_id, sizeof(device_id), "snow-%02x%02x%02x", mac[3],
+             mac[4], mac[5]);
+  }
+
+  return device_id;
+}
+
+esp_err_t telemetry_publish(MQTT_Client *mqtt_client) {
+  if (strlen(CONFIG_ESP_MQTT_TELEMETRY_TOPIC) == 0) {
+    return ESP_OK;
+  }
+
+  const supervisor_stats_t *stats = supervisor_get_stats();
+  const wifi_stats_t *wifi = wifi_get_stats();
+  char payload[TELEMETRY_MAX_PAYLOAD_LENGTH];
+  char power[TELEMETRY_MAX_PAYLOAD_LENGTH / 2] = "";
+
+#ifdef CONFIG_ESP_DYNAMIC_FREQUENCY
+  // Time and estimated CPU charge of each phase of the last cycle
+  const power_stats_t *power_stats = power_get_stats();
+  int power_len = 0;
+  for (int i = 0; i < SUPERVISOR_PHASE_COUNT; i++) {
+    const power_phase_stats_t *phase = &power_stats->phases[i];
+    power_len += snprintf(
+        power + power_len, sizeof(power) - power_len,
+        "%s\"%s\":{\"ms\":%lu, \"max_freq_ms\":%lu, \"charge_uah\":%.1f}%s",
+        i == 0 ? ", \"power\":{" : ", ", supervisor_phase_name(i),
+        (unsigned long)phase->ms, (unsigned long)phase->max_freq_ms,
+        power_estimate_charge_uah(phase),
+        i == SUPERVISOR_PHASE_COUNT - 1 ? "}" : "");
+    if (power_len >= (int)sizeof(power)) {
+      ESP_LOGE(TAG, "Telemetry payload too long");
+      return ESP_ERR_INVALID_SIZE;
+    }
+  }
+#endif
+
+  char bytes[TELEMETRY_MAX_PAYLOAD_LENGTH / 4] = "";
+#ifndef CONFIG_ESP_SCANNER_MODE
+  // Reading messages of the last cycle, against the same readings as JSON,
+  // and what their pacing cost
+  const payload_stats_t *payload_stats = payload_get_stats();
+  const pacing_stats_t *pacing_stats = pacing_get_stats();
+  snprintf(bytes, sizeof(bytes),
+           ", \"payload\":{\"messages\":%lu, \"bytes\":%lu, "
+           "\"json_bytes\":%lu, \"deferred\":%lu, \"dropped\":%lu, "
+           "\"wait_ms\":%lu}",
+           (unsigned long)payload_stats->messages,
+           (unsigned long)payload_stats->bytes,
+           (unsigned long)payload_stats->json_bytes,
+           (unsigned long)pacing_stats->deferred,
+           (unsigned long)pacing_stats->dropped,
+           (unsigned long)pacing_stats->wait_ms);
+#endif
+
+  int len = snprintf(
+      payload, sizeof(payload),
+      "{\"device\":\"%s\", \"cycles\":%lu, \"last_cycle_ms\":%lu, "
+      "\"overruns\":{\"cycle\":%lu, \"acquisition\":%lu, \"connect\":%lu, "
+      "\"publish\":%lu}, \"wifi\":{\"profile\":\"%s\", \"connect_ms\":%lu, "
+      "\"rssi\":%d, \"channel\":%d, \"retries\":%d}%s%s}",
+      telemetry_device_id(), (unsigned long)stats->cycles,
+      (unsigned long)stats->last_cycle_ms,
+      (unsigned long)stats->cycle_overruns,
+      (unsigned long)stats->phase_overruns[SUPERVISOR_PHASE_ACQUISITION],
+      (unsigned long)stats->phase_overruns[SUPERVISOR_PHASE_CONNECT],
+      (unsigned long)stats->phase_overruns[SUPERVISOR_PHASE_PUBLISH],
+      wifi_get_profile()->name, (unsigned long)wifi->connect_ms, wifi->rssi,
+      wifi->channel, wifi->retries, bytes, power);
+  if (len < 0 || len >= (int)sizeof(payload)) {
+    ESP_LOGE(TAG, "Telemetry payload too long");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  return mqtt_publish_topic(mqtt_client, CONFIG_ESP_MQTT_TELEMETRY_TOPIC,
+                            payload);
+}
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+// Cycle the sensor statistics were last published to each broker, so that a
+// cycle that skips the network only delays them
+RTC_DATA_ATTR static uint32_t s_stats_cycles[CONFIG_ESP_MAX_BROKERS];
+
+esp_err_t telemetry_publish_sensor_stats(MQTT_Client *mqtt_client,
+                                         const device_table_t *devices,
+                                         int num_sensors, bool force) {
+  if (strlen(CONFIG_ESP_MQTT_TELEMETRY_TOPIC) == 0) {
+    return ESP_OK;
+  }
+  int broker = mqtt_client->broker;
+  if (broker < 0 || broker >= CONFIG_ESP_MAX_BROKERS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint32_t cycles = supervisor_get_stats()->cycles;
+  bool due = CONFIG_ESP_SENSOR_STATS_INTERVAL != 0 &&
+             cycles - s_stats_cycles[broker] >=
+                 CONFIG_ESP_SENSOR_STATS_INTERVAL;
+  if (!force && !due) {
+    return ESP_OK;
+  }
+
+  esp_err_t result = ESP_OK;
+  for (int i = 0; i < num_sensors; i++) {
+    const sensor_stats_t *stats = sensor_stats_get(i);
+    char topic[MAX_MQTT_TOPIC_LENGTH];
+    char payload[TELEMETRY_MAX_PAYLOAD_LENGTH];
+
+    if (stats == NULL) {
+      break;
+    }
+
+    snprintf(topic, sizeof(topic), "%s/sensor/%d",
+             CONFIG_ESP_MQTT_TELEMETRY_TOPIC, devices->idx[i]);
+    snprintf(payload, sizeof(payload),
+             "{\"device\":\"%s\", \"address\":\"%016llX\", \"idx\":%d, "
+             "\"reads\":%lu, \"crc_errors\":%lu, \"presence_errors\":%lu, "
+             "\"retries\":%lu, \"health\":\"%s\"}",
+             telemetry_device_id(), devices->rom[i], devices->idx[i],
+             (unsigned long)stats->reads, (unsigned long)stats->crc_errors,
+             (unsigned long)stats->presence_errors,
+             (unsigned long)stats->retries,
+             health_state_name(health_get_state(i)));
+
+    esp_err_t err = mqtt_publish_topic(mqtt_client, topic, payload);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to publish statistics of sensor %d",
+               devices->idx[i]);
+      result = err;
+    }
+  }
+
+  if (result == ESP_OK) {
+    // Published again next cycle otherwise
+    s_stats_cycles[broker] = cycles;
+  }
+  return result;
+}
+
+esp_err_t telemetry_publish_health_events(MQTT_Client *mqtt_client,
+                                          const device_table_t *devices,
+                                          int num_sensors, bool *unsent) {
+  if (strlen(CONFIG_ESP_MQTT_TELEMETRY_TOPIC) == 0) {
+    return ESP_OK;
+  }
+
+  char topic[MAX_MQTT_TOPIC_LENGTH];
+  snprintf(topic, sizeof(topic), "%s/health", CONFIG_ESP_MQTT_TELEMETRY_TOPIC);
+
+  esp_err_t result = ESP_OK;
+  for (int i = 0; i < num_sensors; i++) {
+    health_event_t event;
+    char payload[TELEMETRY_MAX_PAYLOAD_LENGTH];
+
+    if (!health_get_event(i, &event)) {
+      continue;
+    }
+
+    snprintf(payload, sizeof(payload),
+             "{\"device\":\"%s\", \"address\":\"%016llX\", \"idx\":%d, "
+             "\"from\":\"%s\", \"to\":\"%s\", \"reason\":\"%s\"}",
+             telemetry_device_id(), devices->rom[i], devices->idx[i],
+             health_state_name(event.from), health_state_name(event.to),
+             health_reason_name(event.reason));
+
+    esp_err_t err = mqtt_publish_topic(mqtt_client, topic, payload);
+    if (err != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to publish health event of sensor %d",
+               devices->idx[i]);
+      unsent[i] = true;
+      result = err;
+    }
+  }
+
+  return result;
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
@@ -0,0 +1,69 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "esp_err.h"
+#include "mqtt.h"
+#include "sensor_types.h"
+
+#define TELEMETRY_MAX_PAYLOAD_LENGTH 768 ///< Maximum telemetry message length
+#define TELEMETRY_DEVICE_ID_LENGTH 12    ///< "snow-" + 6 hex digits + null
+
+/**
+ * @brief Returns an identifier for this device, derived from its MAC address.
+ *
+ * @return const char* The device identifier (e.g. "snow-a1b2c3").
+ */
+const char *telemetry_device_id(void);
+
+/**
+ * @brief Publishes the device telemetry to `CONFIG_ESP_MQTT_TELEMETRY_TOPIC`.
+ *
+ * Does nothing when the topic is empty.
+ *
+ * @param mqtt_client a pointer to a connected MQTT_Client.
+ * @return esp_err_t Error code indicating success or failure.
+ */
+esp_err_t telemetry_publish(MQTT_Client *mqtt_client);
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Publishes the bus error counters of every sensor.
+ *
+ * Each sensor is published to `<CONFIG_ESP_MQTT_TELEMETRY_TOPIC>/sensor/<idx>`
+ * once `CONFIG_ESP_SENSOR_STATS_INTERVAL` cycles have passed since the last
+ * successful publish to this broker, kept in RTC memory, so a cycle without
+ * network only delays them. Unless forced, does nothing on the other cycles
+ * or when the interval is 0. Does nothing when the topic is empty.
+ *
+ * @param mqtt_client a pointer to a connected MQTT_Client.
+ * @param devices the table of configured sensors.
+ * @param num_sensors the number of configured sensors.
+ * @param force publish whatever the cycle, e.g. on a "stats" command.
+ * @return esp_err_t Error code indicating success or failure.
+ */
+esp_err_t telemetry_publish_sensor_stats(MQTT_Client *mqtt_client,
+                                         const device_table_t *devices,
+                                         int num_sensors, bool force);
+
+/**
+ * @brief Publishes the pending sensor health transitions.
+ *
+ * Each transition is published to `<CONFIG_ESP_MQTT_TELEMETRY_TOPIC>/health`.
+ * Does nothing when the topic is empty. The transitions stay pending until
+ * `health_clear_events()` is called.
+ *
+ * @param mqtt_client a pointer to a connected MQTT_Client.
+ * @param devices the table of configured sensors.
+ * @param num_sensors the number of configured sensors.
+ * @param unsent set to true for each sensor whose transition could not be
+ * published, left unchanged for the others.
+ * @return esp_err_t Error code indicating success or failure.
+ */
+esp_err_t telemetry_publish_health_events(MQTT_Client *mqtt_client,
+                                          const device_table_t *devices,
+                                          int num_sensors, bool *unsent);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // TELEMETRY_H
@@ -0,0 +1,117 @@
+#include "topics.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+static const char *TAG = "topics";
+
+static char s_pool[CONFIG_ESP_MQTT_TOPIC_POOL_SIZE];
+static const char *s_topics[CONFIG_ESP_MAX_BROKERS][CONFIG_ESP_MAX_SENSORS];
+
+bool topics_is_template(const mqtt_broker_config_t *config) {
+  return strstr(config->topic, "{idx}") != NULL ||
+         strstr(config->topic, "{rom}") != NULL ||
+         strstr(config->topic, "{bus}") != NULL;
+}
+
+/**
+ * Expands a template for a sensor. Unknown placeholders are kept as they
+ * are.
+ *
+ * Returns the length of the topic, which was truncated if it is not less
+ * than `size`.
+ */
+static int expand(const char *template, const device_table_t *devices,
+                  int sensor, char *out, size_t size) {
+  size_t length = 0;
+
+  for (const char *p = template; *p != '\0';) {
+    char value[MAX_SENSOR_ADDRESS_LENGTH];
+
+    if (strncmp(p, "{idx}", 5) == 0) {
+      snprintf(value, sizeof(value), "%d", devices->idx[sensor]);
+    } else if (strncmp(p, "{rom}", 5) == 0) {
+      snprintf(value, sizeof(value), "%016llX", devices->rom[sensor]);
+    } else if (strncmp(p, "{bus}", 5) == 0) {
+      snprintf(value, sizeof(value), "%d", devices->bus[sensor]);
+    } else {
+      if (length + 1 < size) {
+        out[length] = *p;
+      }
+      length++;
+      p++;
+      continue;
+    }
+
+    size_t value_length = strlen(value);
+    if (length + value_length < size) {
+      memcpy(out + length, value, value_length);
+    }
+    length += value_length;
+    p += 5;
+  }
+
+  if (size > 0) {
+    out[length < size ? length : size - 1] = '\0';
+  }
+  return length;
+}
+
+esp_err_t topics_build(const mqtt_config_t *mqtt_config,
+                       const device_table_t *devices, int num_sensors) {
+  size_t used = 0;
+  esp_err_t result = ESP_OK;
+
+  memset(s_topics, 0, sizeof(s_topics));
+
+  for (int i = 0; i < mqtt_config->broker_count; i++) {
+    const mqtt_broker_config_t *config = &mqtt_config->brokers[i];
+    bool expanded =
+        config->format == MQTT_PAYLOAD_JSON && topics_is_template(config);
+
+    if (!expanded && topics_is_template(config)) {
+      ESP_LOGW(TAG, "Topic %s is not expanded, CBOR readings share a topic",
+               config->topic);
+    }
+
+    for (int j = 0; j < num_sensors && j < CONFIG_ESP_MAX_SENSORS; j++) {
+      if (!expanded) {
+        s_topics[i][j] = config->topic;
+        continue;
+      }
+
+      char *topic = s_pool + used;
+      int length = expand(config->topic, devices, j, topic,
+                          sizeof(s_pool) - used);
+      if (used + length >= sizeof(s_pool)) {
+        // Not even a truncated topic is published
+        result = ESP_ERR_NO_MEM;
+        continue;
+      }
+
+      s_topics[i][j] = topic;
+      used += length + 1;
+    }
+  }
+
+  if (result != ESP_OK) {
+    ESP_LOGE(TAG, "Topic pool full, raise ESP_MQTT_TOPIC_POOL_SIZE");
+  }
+  ESP_LOGD(TAG, "Topic pool: %u of %u bytes used", (unsigned)used,
+           (unsigned)sizeof(s_pool));
+  return result;
+}
+
+const char *topics_get(int broker, int sensor) {
+  if (broker < 0 || broker >= CONFIG_ESP_MAX_BROKERS || sensor < 0 ||
+      sensor >= CONFIG_ESP_MAX_SENSORS) {
+    return NULL;
+  }
+  return s_topics[broker][sensor];
+}
+
+#endif // CONFIG_ESP_SCANNER_MODE
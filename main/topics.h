@@ -0,0 +1,51 @@
+#ifndef TOPICS_H
+#define TOPICS_H
+
+#include <stdbool.h>
+
+#include "config_types.h"
+#include "esp_err.h"
+#include "sensor_types.h"
+
+#ifndef CONFIG_ESP_SCANNER_MODE
+
+/**
+ * @brief Returns whether the topic of a broker is a per-sensor template.
+ *
+ * A template holds at least one of the `{idx}`, `{rom}` and `{bus}`
+ * placeholders. Templates only apply to the JSON format, a CBOR message
+ * holds the readings of every sensor.
+ *
+ * @param config configuration of the broker.
+ * @return true if each sensor publishes to a topic of its own.
+ */
+bool topics_is_template(const mqtt_broker_config_t *config);
+
+/**
+ * @brief Expands the topic of every broker for every sensor.
+ *
+ * Called once the device table is built. The expanded topics are stored in
+ * a static pool of `CONFIG_ESP_MQTT_TOPIC_POOL_SIZE` bytes; sensors whose
+ * topic does not fit keep no topic and are not published. Brokers without
+ * template share their topic between the sensors.
+ *
+ * @param mqtt_config the MQTT configuration.
+ * @param devices the table of configured sensors.
+ * @param num_sensors the number of configured sensors.
+ * @return esp_err_t ESP_OK, or ESP_ERR_NO_MEM if the pool is too small.
+ */
+esp_err_t topics_build(const mqtt_config_t *mqtt_config,
+                       const device_table_t *devices, int num_sensors);
+
+/**
+ * @brief Returns the topic a sensor publishes its readings to on a broker.
+ *
+ * @param broker position of the broker in the MQTT configuration.
+ * @param sensor flat id of the sensor.
+ * @return const char* the topic, NULL if it could not be expanded.
+ */
+const char *topics_get(int broker, int sensor);
+
+#endif // CONFIG_ESP_SCANNER_MODE
+
+#endif // TOPICS_H
@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "esp_log.h"
+
+static const char *TAG = "utils";
+
 void skip_whitespace(const char **str) {
   while (**str != '\0' && isspace((unsigned char)**str)) {
     (*str)++;
@@ -23,27 +27,30 @@ int str_to_int_array(const char *str, char delimiter, int *arr, int arr_size) {
   }
 
   int count = 0;
+  int ignored = 0;
   const char *start = str;
-  while (*str != '\0') {
-    if (*str == delimiter) {
-      if (count < arr_size) {
-        int num = atoi(start);
-        if (num != 0 || *start == '0') {
-          arr[count] = num;
-          count++;
-        }
-        start = str + 1;
-      }
+  for (;; str++) {
+    if (*str != delimiter && *str != '\0') {
+      continue;
     }
-    str++;
-  }
 
-  if (count < arr_size) {
     int num = atoi(start);
     if (num != 0 || *start == '0') {
-      arr[count] = num;
-      count++;
+      if (count < arr_size) {
+        arr[count++] = num;
+      } else {
+        ignored++;
+      }
+    }
+
+    if (*str == '\0') {
+      break;
     }
+    start = str + 1;
+  }
+
+  if (ignored > 0) {
+    ESP_LOGW(TAG, "Ignored %d values beyond the first %d", ignored, arr_size);
   }
 
   return count;
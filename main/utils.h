@@ -17,7 +17,8 @@ void skip_whitespace(const char **str);
  * @param str The string to convert (e.g. "1,2,3,4")
  * @param delimiter The delimiter to use (e.g. ',')
  * @param arr The array to store the integers
- * @param arr_size The size of the array
+ * @param arr_size The size of the array, values beyond it are ignored with a
+ * warning
  * @return int The number of integers converted
  */
 int str_to_int_array(const char *str, char delimiter, int *arr, int arr_size);
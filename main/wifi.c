@@ -1,6 +1,9 @@
 #include "wifi.h"
 
+#include "esp_attr.h"
+#include "esp_check.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 
 /* FreeRTOS event group to signal when we are connected*/
@@ -17,12 +20,64 @@ static const char *TAG = "wifi";
 
 int s_retry_num = 0;
 
+static bool s_initialized = false;
+static bool s_started = false;
+
+// Steps of wifi_init_stack() that succeeded. None of them may be done twice,
+// so a failed init resumes after them on the next cycle.
+static esp_netif_t *s_netif = NULL;
+static bool s_driver_initialized = false;
+static esp_event_handler_instance_t s_wifi_handler = NULL;
+static esp_event_handler_instance_t s_ip_handler = NULL;
+
+RTC_DATA_ATTR static wifi_backoff_t s_backoff = {0};
+
+static wifi_stats_t s_stats = {0};
+
+#if CONFIG_ESP_WIFI_PROFILE_BURST
+// Awake for a few hundred bytes: small pools, fastest rates, no power save
+static const wifi_profile_t s_profile = {
+    .name = "burst",
+    .static_rx_buf = 4,
+    .dynamic_rx_buf = 16,
+    .dynamic_tx_buf = 16,
+    .ampdu = false,
+    .max_tx_power = 78, // 19.5 dBm
+    .protocols = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N,
+    .power_save = WIFI_PS_NONE,
+};
+#elif CONFIG_ESP_WIFI_PROFILE_LOW_POWER
+// Connected all day: sleep between beacons and transmit softly
+static const wifi_profile_t s_profile = {
+    .name = "low_power",
+    .ampdu = true,
+    .max_tx_power = 52, // 13 dBm
+    .power_save = WIFI_PS_MAX_MODEM,
+};
+#elif CONFIG_ESP_WIFI_PROFILE_LONG_RANGE
+// Far from the access point: slowest, most robust rates at full power
+static const wifi_profile_t s_profile = {
+    .name = "long_range",
+    .ampdu = false,
+    .max_tx_power = 84, // 21 dBm
+    .protocols = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_LR,
+    .power_save = WIFI_PS_NONE,
+};
+#else
+static const wifi_profile_t s_profile = {
+    .name = "default",
+    .ampdu = true,
+    .power_save = WIFI_PS_MIN_MODEM,
+};
+#endif
+
 void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
                    void *event_data) {
   if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
     esp_wifi_connect();
   } else if (event_base == WIFI_EVENT &&
              event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     if (s_retry_num < WIFI_MAX_RETRY) {
       esp_wifi_connect();
       s_retry_num++;
@@ -34,28 +89,77 @@ void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+    s_stats.retries = s_retry_num;
     s_retry_num = 0;
     xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
   }
 }
 
-esp_err_t wifi_init_sta(void) {
-  s_wifi_event_group = xEventGroupCreate();
+/**
+ * Initializes the WiFi driver with the buffers of the radio profile.
+ */
+static esp_err_t wifi_init_driver(void) {
+  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+  if (s_profile.static_rx_buf > 0) {
+    cfg.static_rx_buf_num = s_profile.static_rx_buf;
+  }
+  if (s_profile.dynamic_rx_buf > 0) {
+    cfg.dynamic_rx_buf_num = s_profile.dynamic_rx_buf;
+  }
+  if (s_profile.dynamic_tx_buf > 0) {
+    cfg.dynamic_tx_buf_num = s_profile.dynamic_tx_buf;
+  }
+  if (!s_profile.ampdu) {
+    cfg.ampdu_rx_enable = 0;
+    cfg.ampdu_tx_enable = 0;
+  }
+  return esp_wifi_init(&cfg);
+}
 
-  ESP_ERROR_CHECK(esp_netif_init());
+static esp_err_t wifi_init_stack(void) {
+  if (s_wifi_event_group == NULL) {
+    s_wifi_event_group = xEventGroupCreate();
+    if (s_wifi_event_group == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
 
-  ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
+  if (s_netif == NULL) {
+    ESP_RETURN_ON_ERROR(esp_netif_init(), TAG, "esp_netif_init failed");
 
-  wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-  ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    // Already created by an earlier attempt or by another component
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+      ESP_LOGE(TAG, "esp_event_loop_create_default failed");
+      return err;
+    }
+
+    s_netif = esp_netif_create_default_wifi_sta();
+    if (s_netif == NULL) {
+      ESP_LOGE(TAG, "esp_netif_create_default_wifi_sta failed");
+      return ESP_FAIL;
+    }
+  }
 
-  esp_event_handler_instance_t instance_any_id;
-  esp_event_handler_instance_t instance_got_ip;
-  ESP_ERROR_CHECK(esp_event_handler_instance_register(
-      WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, &instance_any_id));
-  ESP_ERROR_CHECK(esp_event_handler_instance_register(
-      IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, &instance_got_ip));
+  if (!s_driver_initialized) {
+    ESP_RETURN_ON_ERROR(wifi_init_driver(), TAG, "esp_wifi_init failed");
+    s_driver_initialized = true;
+  }
+
+  if (s_wifi_handler == NULL) {
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                            &event_handler, NULL,
+                                            &s_wifi_handler),
+        TAG, "failed to register WiFi event handler");
+  }
+  if (s_ip_handler == NULL) {
+    ESP_RETURN_ON_ERROR(
+        esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                            &event_handler, NULL,
+                                            &s_ip_handler),
+        TAG, "failed to register IP event handler");
+  }
 
   wifi_config_t wifi_config = {
       .sta =
@@ -72,32 +176,140 @@ esp_err_t wifi_init_sta(void) {
               .threshold.authmode = WIFI_SCAN_AUTH_MODE_THRESHOLD,
               .sae_pwe_h2e = WIFI_SAE_MODE,
               .sae_h2e_identifier = WIFI_H2E_IDENTIFIER,
+#ifdef CONFIG_ESP_LIGHT_SLEEP
+              .listen_interval = CONFIG_ESP_WIFI_LISTEN_INTERVAL,
+#endif
           },
   };
-  ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-  ESP_ERROR_CHECK(esp_wifi_start());
+  ESP_RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA), TAG,
+                      "esp_wifi_set_mode failed");
+  ESP_RETURN_ON_ERROR(esp_wifi_set_config(WIFI_IF_STA, &wifi_config), TAG,
+                      "esp_wifi_set_config failed");
+  if (s_profile.protocols != 0) {
+    ESP_RETURN_ON_ERROR(esp_wifi_set_protocol(WIFI_IF_STA, s_profile.protocols),
+                        TAG, "esp_wifi_set_protocol failed");
+  }
+
+  wifi_ps_type_t power_save = s_profile.power_save;
+#ifdef CONFIG_ESP_LIGHT_SLEEP
+  // Stay associated between readings, waking for one beacon out of
+  // `listen_interval` only, whatever the profile
+  power_save = WIFI_PS_MAX_MODEM;
+#endif
+  ESP_RETURN_ON_ERROR(esp_wifi_set_ps(power_save), TAG,
+                      "esp_wifi_set_ps failed");
+
+  ESP_LOGI(TAG, "Radio profile: %s", s_profile.name);
+
+  return ESP_OK;
+}
+
+static void wifi_record_failure(void) {
+  s_backoff.failures++;
+  if (s_backoff.failures >= CONFIG_ESP_WIFI_BACKOFF_THRESHOLD) {
+    // Double the number of skipped cycles with every further failure
+    int exponent = s_backoff.failures - CONFIG_ESP_WIFI_BACKOFF_THRESHOLD;
+    int skip = exponent < 15 ? 1 << exponent : CONFIG_ESP_WIFI_BACKOFF_MAX_SKIP;
+    if (skip > CONFIG_ESP_WIFI_BACKOFF_MAX_SKIP) {
+      skip = CONFIG_ESP_WIFI_BACKOFF_MAX_SKIP;
+    }
+    s_backoff.skip_cycles = skip;
+    ESP_LOGW(TAG, "%d consecutive failures, skipping the network for %d cycles",
+             s_backoff.failures, skip);
+  }
+}
+
+bool wifi_should_skip_network(void) {
+  if (s_backoff.skip_cycles == 0) {
+    return false;
+  }
+
+  s_backoff.skip_cycles--;
+  ESP_LOGI(TAG, "Backing off, network skipped (%d more cycles)",
+           s_backoff.skip_cycles);
+  return true;
+}
+
+static void wifi_update_signal(void) {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    s_stats.rssi = ap.rssi;
+    s_stats.channel = ap.primary;
+  }
+}
+
+const wifi_profile_t *wifi_get_profile(void) { return &s_profile; }
+
+const wifi_stats_t *wifi_get_stats(void) { return &s_stats; }
+
+esp_err_t wifi_init_sta(void) {
+  if (!s_initialized) {
+    esp_err_t err = wifi_init_stack();
+    if (err != ESP_OK) {
+      return err;
+    }
+    s_initialized = true;
+  }
+
+  if (xEventGroupGetBits(s_wifi_event_group) & WIFI_CONNECTED_BIT) {
+    s_stats.connect_ms = 0;
+    s_stats.retries = 0;
+    wifi_update_signal();
+    return ESP_OK;
+  }
+
+  xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
+  s_retry_num = 0;
+
+  int64_t start = esp_timer_get_time();
+  if (!s_started) {
+    // Connecting is triggered by the WIFI_EVENT_STA_START event
+    ESP_RETURN_ON_ERROR(esp_wifi_start(), TAG, "esp_wifi_start failed");
+    s_started = true;
+    if (s_profile.max_tx_power != 0) {
+      // Only accepted once the radio is started
+      esp_wifi_set_max_tx_power(s_profile.max_tx_power);
+    }
+  } else {
+    esp_wifi_connect();
+  }
 
   ESP_LOGI(TAG, "wifi_init_sta finished.");
 
-  /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or
-   * connection failed for the maximum number of re-tries (WIFI_FAIL_BIT). The
-   * bits are set by event_handler() (see above) */
-  EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                         WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                         pdFALSE, pdFALSE, portMAX_DELAY);
+  /* Waiting until either the connection is established (WIFI_CONNECTED_BIT),
+   * connection failed for the maximum number of re-tries (WIFI_FAIL_BIT) or
+   * the timeout expired. The bits are set by event_handler() (see above) */
+  EventBits_t bits =
+      xEventGroupWaitBits(s_wifi_event_group,
+                          WIFI_CONNECTED_BIT | WIFI_FAIL_BIT, pdFALSE, pdFALSE,
+                          pdMS_TO_TICKS(WIFI_CONNECT_TIMEOUT));
 
   /* xEventGroupWaitBits() returns the bits before the call returned, hence we
    * can test which event actually happened. */
   if (bits & WIFI_CONNECTED_BIT) {
-    ESP_LOGI(TAG, "connected to ap SSID:%s password:%s", WIFI_SSID, WIFI_PASS);
+    s_stats.connect_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+    wifi_update_signal();
+    ESP_LOGI(TAG,
+             "connected to ap SSID:%s in %lu ms (RSSI %d dBm, channel %d, "
+             "%d retries)",
+             WIFI_SSID, (unsigned long)s_stats.connect_ms, s_stats.rssi,
+             s_stats.channel, s_stats.retries);
+    s_backoff.failures = 0;
+    s_backoff.skip_cycles = 0;
     return ESP_OK;
-  } else if (bits & WIFI_FAIL_BIT) {
-    ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s", WIFI_SSID,
-             WIFI_PASS);
+  }
+
+  if (bits & WIFI_FAIL_BIT) {
+    ESP_LOGI(TAG, "Failed to connect to SSID:%s", WIFI_SSID);
   } else {
-    ESP_LOGE(TAG, "UNEXPECTED EVENT");
+    ESP_LOGW(TAG, "Timed out connecting to SSID:%s after %d ms", WIFI_SSID,
+             WIFI_CONNECT_TIMEOUT);
   }
 
-  return ESP_FAIL;
-}
\ No newline at end of file
+  // Power the radio down until the next attempt
+  esp_wifi_stop();
+  s_started = false;
+  wifi_record_failure();
+
+  return bits & WIFI_FAIL_BIT ? ESP_FAIL : ESP_ERR_TIMEOUT;
+}
@@ -1,12 +1,17 @@
 #ifndef WIFI_H
 #define WIFI_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_event.h"
+#include "esp_wifi.h"
 #include "freertos/event_groups.h"
 
 #define WIFI_SSID CONFIG_ESP_WIFI_SSID
 #define WIFI_PASS CONFIG_ESP_WIFI_PASSWORD
 #define WIFI_MAX_RETRY CONFIG_ESP_WIFI_MAX_RETRY
+#define WIFI_CONNECT_TIMEOUT CONFIG_ESP_WIFI_CONNECT_TIMEOUT
 
 #if CONFIG_ESP_WPA3_SAE_PWE_HUNT_AND_PECK
 #define WIFI_SAE_MODE WPA3_SAE_PWE_HUNT_AND_PECK
@@ -49,6 +54,40 @@ extern EventGroupHandle_t s_wifi_event_group;
 
 extern int s_retry_num;
 
+/**
+ * @brief Connection failure history, kept in RTC memory across deep sleep.
+ */
+typedef struct {
+  uint16_t failures;    ///< Consecutive wakes that failed to connect
+  uint16_t skip_cycles; ///< Upcoming cycles that skip the network entirely
+} wifi_backoff_t;
+
+/**
+ * @brief Radio parameters applied as a group when the WiFi stack starts.
+ *
+ * Zero buffer counts, TX power and protocols keep the ESP-IDF defaults.
+ */
+typedef struct {
+  const char *name;          ///< Reported in the telemetry
+  uint8_t static_rx_buf;     ///< Number of static RX buffers
+  uint8_t dynamic_rx_buf;    ///< Number of dynamic RX buffers
+  uint8_t dynamic_tx_buf;    ///< Number of dynamic TX buffers
+  bool ampdu;                ///< Whether AMPDU is enabled
+  int8_t max_tx_power;       ///< Maximum TX power, in 0.25 dBm steps
+  uint8_t protocols;         ///< Bitmap of `WIFI_PROTOCOL_*`
+  wifi_ps_type_t power_save; ///< Power save mode while connected
+} wifi_profile_t;
+
+/**
+ * @brief Connection figures of the current wake.
+ */
+typedef struct {
+  uint32_t connect_ms; ///< Time to join and get an address, 0 if reused
+  uint8_t retries;     ///< Association retries of the last connection
+  int8_t rssi;         ///< Signal strength of the access point, in dBm
+  uint8_t channel;     ///< Channel of the access point
+} wifi_stats_t;
+
 /**
  * @brief Event handler for WiFi events.
  *
@@ -61,8 +100,43 @@ void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
                    void *event_data);
 
 /**
- * @brief Initialize the WiFi station.
+ * @brief Initialize the WiFi station and connect to the access point.
+ *
+ * The WiFi stack is initialized on the first call only, later calls reconnect
+ * if the connection was lost. Waits at most `WIFI_CONNECT_TIMEOUT`
+ * milliseconds. On failure the radio is stopped and the failure is recorded
+ * for the backoff.
+ *
+ * @return esp_err_t ESP_OK once connected, an error code otherwise.
  */
 esp_err_t wifi_init_sta(void);
 
+/**
+ * @brief Checks whether this cycle should skip the network.
+ *
+ * After `CONFIG_ESP_WIFI_BACKOFF_THRESHOLD` consecutive failed connections,
+ * the network is skipped for an exponentially growing number of cycles,
+ * capped at `CONFIG_ESP_WIFI_BACKOFF_MAX_SKIP`. Each call that returns true
+ * consumes one skipped cycle.
+ *
+ * @return true if the network should not be used this cycle.
+ */
+bool wifi_should_skip_network(void);
+
+/**
+ * @brief Returns the radio profile selected by `CONFIG_ESP_WIFI_PROFILE`.
+ *
+ * @return const wifi_profile_t* The profile.
+ */
+const wifi_profile_t *wifi_get_profile(void);
+
+/**
+ * @brief Returns the connection figures of the current wake.
+ *
+ * The figures are updated by every successful `wifi_init_sta()`.
+ *
+ * @return const wifi_stats_t* The figures.
+ */
+const wifi_stats_t *wifi_get_stats(void);
+
 #endif // WIFI_H
@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Decodes the CBOR cycle messages of SNOW and republishes them as JSON.
+
+A broker selects the CBOR format with `format=cbor` in its connection string.
+The device then publishes one message per cycle holding all its readings (see
+main/payload.h). This script turns such a message back into the JSON messages
+the device publishes in the JSON format, one per reading.
+
+Decode a message saved to a file:
+
+    cbor_bridge.py decode < message.cbor
+
+Bridge a topic to another one (requires paho-mqtt):
+
+    cbor_bridge.py bridge --host mosquitto --topic snow/cbor --output snow/json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+# Keys of the cycle message, see PAYLOAD_KEY_* in main/payload.h
+KEY_DEVICE = 0
+KEY_CYCLE = 1
+KEY_RSSI = 2
+KEY_READINGS = 3
+
+BREAK = object()
+
+
+class Decoder:
+    """Decodes the subset of CBOR (RFC 8949) used by the device."""
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def read(self, size):
+        if self.pos + size > len(self.data):
+            raise ValueError("truncated message")
+        chunk = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return chunk
+
+    def argument(self, info):
+        if info < 24:
+            return info
+        if info == 31:
+            return None  # Indefinite length
+        sizes = {24: ">B", 25: ">H", 26: ">I", 27: ">Q"}
+        if info not in sizes:
+            raise ValueError("invalid additional information %d" % info)
+        fmt = sizes[info]
+        return struct.unpack(fmt, self.read(struct.calcsize(fmt)))[0]
+
+    def item(self):
+        initial = self.read(1)[0]
+        major, info = initial >> 5, initial & 0x1F
+        if initial == 0xFF:
+            return BREAK
+        value = self.argument(info)
+
+        if major == 0:
+            return value
+        if major == 1:
+            return -1 - value
+        if major in (2, 3):
+            if value is None:
+                raise ValueError("indefinite strings are not supported")
+            chunk = self.read(value)
+            return chunk if major == 2 else chunk.decode("utf-8")
+        if major == 4:
+            return self.sequence(value, self.item)
+        if major == 5:
+            return dict(self.sequence(value, self.pair))
+        raise ValueError("unsupported major type %d" % major)
+
+    def pair(self):
+        key = self.item()
+        return BREAK if key is BREAK else (key, self.item())
+
+    def sequence(self, count, element):
+        items = []
+        while count is None or len(items) < count:
+            value = element()
+            if value is BREAK:
+                if count is not None:
+                    raise ValueError("unexpected break")
+                break
+            items.append(value)
+        return items
+
+
+def decode(data):
+    """Returns the device metadata and the readings of a cycle message."""
+    message = Decoder(data).item()
+    if not isinstance(message, dict):
+        raise ValueError("not a cycle message")
+
+    readings = []
+    for fields in message.get(KEY_READINGS, []):
+        rom, idx, centidegrees, resolution, spread = fields[:5]
+        readings.append({
+            "address": "%016X" % rom,
+            "idx": idx,
+            "temperature": round(centidegrees / 100, 2),
+            "resolution": resolution,
+            "spread": round(spread / 16, 2),
+        })
+
+    metadata = {
+        "device": message.get(KEY_DEVICE),
+        "cycle": message.get(KEY_CYCLE),
+        "rssi": message.get(KEY_RSSI),
+    }
+    return metadata, readings
+
+
+def to_json(metadata, reading, domoticz):
+    """Formats a reading like the JSON payloads of the device."""
+    if domoticz:
+        payload = {
+            "command": "udevice",
+            "idx": reading["idx"],
+            "svalue": "%.2f" % reading["temperature"],
+            "resolution": reading["resolution"],
+        }
+    else:
+        payload = dict(reading, device=metadata["device"])
+    return json.dumps(payload)
+
+
+def run_decode(args):
+    metadata, readings = decode(sys.stdin.buffer.read())
+    print(json.dumps(metadata), file=sys.stderr)
+    for reading in readings:
+        print(to_json(metadata, reading, args.domoticz))
+
+
+def run_bridge(args):
+    try:
+        import paho.mqtt.client as mqtt
+    except ImportError:
+        sys.exit("The bridge requires paho-mqtt: pip install paho-mqtt")
+
+    def on_connect(client, userdata, *rest):
+        client.subscribe(args.topic, qos=1)
+
+    def on_message(client, userdata, msg):
+        try:
+            metadata, readings = decode(msg.payload)
+        except ValueError as err:
+            print("Ignoring message on %s: %s" % (msg.topic, err),
+                  file=sys.stderr)
+            return
+        for reading in readings:
+            client.publish(args.output, to_json(metadata, reading,
+                                                args.domoticz))
+
+    try:
+        client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        client = mqtt.Client()  # paho-mqtt 1.x
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.loop_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--domoticz", action="store_true",
+                        help="emit Domoticz udevice commands")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    commands.add_parser("decode", help="decode a message read from stdin")
+
+    bridge = commands.add_parser("bridge", help="republish a topic as JSON")
+    bridge.add_argument("--host", default="localhost")
+    bridge.add_argument("--port", type=int, default=1883)
+    bridge.add_argument("--username")
+    bridge.add_argument("--password")
+    bridge.add_argument("--topic", required=True,
+                        help="topic the device publishes CBOR to")
+    bridge.add_argument("--output", required=True,
+                        help="topic to republish the JSON readings to")
+
+    args = parser.parse_args()
+    if args.command == "decode":
+        run_decode(args)
+    else:
+        run_bridge(args)
+
+
+if __name__ == "__main__":
+    main()